@@ -0,0 +1,246 @@
+#include "v8eval.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Measures the cost of the v8eval operations.
+//
+// Usage: v8eval-bench [filter]
+//
+// Every benchmark whose name contains 'filter' is run, and one JSON object is printed per line:
+//   {"name":"eval_small","iterations":65536,"ns_per_op":1234.5,"ops_per_sec":810045.3}
+// The iteration count is calibrated to make a run take about kMinRunTime,
+// and the reported time is the median of kRepetitions runs.
+
+namespace {
+
+const std::chrono::nanoseconds kMinRunTime = std::chrono::milliseconds(200);
+const int kRepetitions = 5;
+
+// runs the operation 'iterations' times and returns the number of operations performed
+typedef std::function<uint64_t(uint64_t iterations)> Body;
+
+double measure(const Body& body, uint64_t iterations, uint64_t* ops) {
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  *ops = body(iterations);
+  std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+  return static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+}
+
+void run(const char* filter, const std::string& name, const Body& body) {
+  if (!strstr(name.c_str(), filter)) {
+    return;
+  }
+
+  // calibrate, which also warms up the compiled code
+  uint64_t iterations = 1;
+  uint64_t ops;
+  double ns = measure(body, iterations, &ops);
+  while (ns < kMinRunTime.count() / 10) {
+    iterations *= 2;
+    ns = measure(body, iterations, &ops);
+  }
+  iterations = std::max<uint64_t>(1, static_cast<uint64_t>(iterations * (kMinRunTime.count() / ns)));
+
+  std::vector<double> ns_per_op;
+  for (int i = 0; i < kRepetitions; i++) {
+    ns = measure(body, iterations, &ops);
+    ns_per_op.push_back(ns / ops);
+  }
+  std::sort(ns_per_op.begin(), ns_per_op.end());
+  double median = ns_per_op[kRepetitions / 2];
+
+  printf("{\"name\":\"%s\",\"iterations\":%llu,\"ns_per_op\":%.1f,\"ops_per_sec\":%.1f}\n", name.c_str(),
+         static_cast<unsigned long long>(iterations), median, 1e9 / median);
+  fflush(stdout);
+}
+
+// JSON array of 'size' numbers
+std::string number_array(size_t size) {
+  std::string json = "[";
+  for (size_t i = 0; i < size; i++) {
+    json += (i == 0 ? "" : ",") + std::to_string(i);
+  }
+  return json + "]";
+}
+
+// JSON array of 'size' objects
+std::string object_array(size_t size) {
+  std::string json = "[";
+  for (size_t i = 0; i < size; i++) {
+    json += (i == 0 ? "" : ",") + std::string("{\"id\":") + std::to_string(i) +
+            ",\"name\":\"item\",\"tags\":[\"a\",\"b\"],\"score\":0.5}";
+  }
+  return json + "]";
+}
+
+v8eval::Value::Array value_object_array(size_t size) {
+  v8eval::Value::Array array;
+  for (size_t i = 0; i < size; i++) {
+    v8eval::Value::Object object;
+    object["id"] = v8eval::Value(static_cast<double>(i));
+    object["name"] = v8eval::Value("item");
+    object["tags"] = v8eval::Value(v8eval::Value::Array{v8eval::Value("a"), v8eval::Value("b")});
+    object["score"] = v8eval::Value(0.5);
+    array.push_back(v8eval::Value(object));
+  }
+  return array;
+}
+
+// JavaScript code of about 'size' functions
+std::string large_script(size_t size) {
+  std::string src;
+  for (size_t i = 0; i < size; i++) {
+    std::string n = std::to_string(i);
+    src += "function f" + n + "(x) { var y = x * " + n + "; for (var i = 0; i < 3; i++) { y += i; } return y; }\n";
+  }
+  return src;
+}
+
+void bench_isolate(const char* filter) {
+  run(filter, "isolate_creation", [](uint64_t iterations) {
+    for (uint64_t i = 0; i < iterations; i++) {
+      v8eval::_V8 v8;
+    }
+    return iterations;
+  });
+}
+
+void bench_context(const char* filter) {
+  v8eval::_V8 v8;
+  run(filter, "context_creation", [&v8](uint64_t iterations) {
+    for (uint64_t i = 0; i < iterations; i++) {
+      v8.reset();
+    }
+    return iterations;
+  });
+}
+
+void bench_eval(const char* filter) {
+  v8eval::_V8 v8;
+  run(filter, "eval_small", [&v8](uint64_t iterations) {
+    for (uint64_t i = 0; i < iterations; i++) {
+      v8.eval("1 + 2");
+    }
+    return iterations;
+  });
+
+  std::string src = large_script(1000);
+  run(filter, "eval_large", [&v8, &src](uint64_t iterations) {
+    for (uint64_t i = 0; i < iterations; i++) {
+      v8.eval(src);
+    }
+    return iterations;
+  });
+
+  v8eval::_V8 uncached;
+  uncached.set_script_cache_capacity(0);
+  run(filter, "eval_large_uncached", [&uncached, &src](uint64_t iterations) {
+    for (uint64_t i = 0; i < iterations; i++) {
+      uncached.eval(src);
+    }
+    return iterations;
+  });
+}
+
+void bench_call(const char* filter) {
+  v8eval::_V8 v8;
+  v8.eval("function id(x) { return x; }");
+  v8eval::_Function id(&v8, "id");
+
+  for (size_t size : {1, 100, 10000}) {
+    std::string args = "[" + number_array(size) + "]";
+    run(filter, "call_args_" + std::to_string(size), [&v8, &args](uint64_t iterations) {
+      for (uint64_t i = 0; i < iterations; i++) {
+        v8.call("id", args);
+      }
+      return iterations;
+    });
+    run(filter, "function_call_args_" + std::to_string(size), [&id, &args](uint64_t iterations) {
+      for (uint64_t i = 0; i < iterations; i++) {
+        id.call(args);
+      }
+      return iterations;
+    });
+  }
+}
+
+void bench_marshalling(const char* filter) {
+  v8eval::_V8 v8;
+  v8.eval("function id(x) { return x; }");
+
+  for (size_t size : {10, 1000}) {
+    std::string args = "[" + object_array(size) + "]";
+    run(filter, "marshal_json_objects_" + std::to_string(size), [&v8, &args](uint64_t iterations) {
+      for (uint64_t i = 0; i < iterations; i++) {
+        v8.call("id", args);
+      }
+      return iterations;
+    });
+
+    v8eval::Value::Array values{v8eval::Value(value_object_array(size))};
+    run(filter, "marshal_value_objects_" + std::to_string(size), [&v8, &values](uint64_t iterations) {
+      v8eval::Value result;
+      for (uint64_t i = 0; i < iterations; i++) {
+        v8.call("id", values, &result);
+      }
+      return iterations;
+    });
+  }
+}
+
+void bench_threads(const char* filter) {
+  size_t max_threads = std::max<size_t>(1, std::thread::hardware_concurrency());
+  // powers of two, ending with the CPU count even if it is not one
+  for (size_t num_threads = 1; num_threads <= max_threads;
+       num_threads = num_threads < max_threads ? std::min(num_threads * 2, max_threads) : max_threads + 1) {
+    std::vector<std::unique_ptr<v8eval::_V8>> instances;
+    for (size_t i = 0; i < num_threads; i++) {
+      instances.emplace_back(new v8eval::_V8());
+      instances.back()->eval("function add(x, y) { return x + y; }");
+    }
+
+    run(filter, "threads_call_" + std::to_string(num_threads), [&instances](uint64_t iterations) {
+      std::vector<std::thread> threads;
+      for (auto& instance : instances) {
+        v8eval::_V8* v8 = instance.get();
+        threads.emplace_back([v8, iterations]() {
+          for (uint64_t i = 0; i < iterations; i++) {
+            v8->call("add", "[1,2]");
+          }
+        });
+      }
+      for (auto& thread : threads) {
+        thread.join();
+      }
+      return iterations * instances.size();
+    });
+  }
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  const char* filter = argc > 1 ? argv[1] : "";
+
+  v8eval::initialize();
+
+  bench_isolate(filter);
+  bench_context(filter);
+  bench_eval(filter);
+  bench_call(filter);
+  bench_marshalling(filter);
+  bench_threads(filter);
+
+  v8eval::dispose();
+  return 0;
+}
@@ -83,7 +83,7 @@ test() {
   install_googletest
 
   cd $V8EVAL_ROOT/build
-  cmake -DCMAKE_BUILD_TYPE=Release -DV8EVAL_TEST=ON ..
+  cmake -DCMAKE_BUILD_TYPE=Release -DV8EVAL_TEST=ON -DV8EVAL_SNAPSHOT=${V8EVAL_SNAPSHOT:-OFF} ..
   make VERBOSE=1
   ./test/v8eval-test || exit 1
 
@@ -92,6 +92,15 @@ test() {
   ./python/build.sh test || exit 1
 }
 
+bench() {
+  build
+
+  cd $V8EVAL_ROOT/build
+  cmake -DCMAKE_BUILD_TYPE=Release -DV8EVAL_BENCH=ON -DV8EVAL_SNAPSHOT=${V8EVAL_SNAPSHOT:-OFF} ..
+  make VERBOSE=1
+  ./bench/v8eval-bench "$2" || exit 1
+}
+
 # dispatch subcommand
 SUBCOMMAND="$1";
 case "${SUBCOMMAND}" in
@@ -100,5 +109,6 @@ case "${SUBCOMMAND}" in
   "python" ) build_python ;;
   "docs"   ) docs ;;
   "test"   ) test ;;
+  "bench"  ) bench "$@" ;;
   *        ) echo "unknown subcommand: ${SUBCOMMAND}"; exit 1 ;;
 esac
@@ -3,6 +3,7 @@ package v8eval
 import (
 	"encoding/json"
 	"errors"
+	"io"
 	"strings"
 )
 
@@ -15,6 +16,17 @@ type V8 interface {
 	// If some JavaScript exception happens in runtime, Eval returns the exception as a Go error.
 	Eval(src string, res interface{}) error
 
+	// EvalReader evaluates the JavaScript code read from 'r' and stores the result into 'res'.
+	// The code is parsed while it is being read, which helps with large scripts.
+	// The result is handled in the same way as Eval.
+	// If reading 'r' fails, EvalReader returns the error of 'r' without running the code.
+	EvalReader(r io.Reader, res interface{}) error
+
+	// EvalFile evaluates the JavaScript file at 'path' and stores the result into 'res'.
+	// The code is parsed while it is being read, which helps with large scripts.
+	// The result is handled in the same way as Eval.
+	EvalFile(path string, res interface{}) error
+
 	// Call calls the JavaScript function specified by 'fun' with the given argument array 'args'
 	// and stores the result into 'res'.
 	// The arguments and the result are marshalled/unmarshalled by using JSON.
@@ -22,10 +34,93 @@ type V8 interface {
 	// If the result cannot be stored into 'res' due to type mismatch, Eval returns the error.
 	// If some JavaScript exception happens in runtime, Call returns the exception as a Go error.
 	Call(fun string, args interface{}, res interface{}) error
+
+	// CallBatch calls the JavaScript function specified by 'fun' once for each argument array in 'argsList'
+	// and stores the array of the results into 'res'.
+	// The arguments and the results are marshalled/unmarshalled by using JSON.
+	// If some JavaScript exception happens in runtime, CallBatch returns the exception as a Go error.
+	CallBatch(fun string, argsList interface{}, res interface{}) error
+
+	// Warmup calls the JavaScript function specified by 'fun' 'iterations' times with each argument array
+	// in 'argsList' and discards the results, so that V8 compiles and optimizes the function before the first actual call.
+	// If some JavaScript exception happens in runtime, Warmup returns the exception as a Go error.
+	Warmup(fun string, argsList interface{}, iterations int) error
+
+	// Function resolves the JavaScript function specified by 'fun' once,
+	// so that calling it through the returned Function skips the lookup by name.
+	Function(fun string) Function
+
+	// Reset discards the JavaScript globals by replacing the context of this instance,
+	// which is cheaper than creating a new V8 instance.
+	// Functions resolved before Reset keep referring to the old globals.
+	Reset()
+
+	// CreateContext creates a context named 'name' with its own JavaScript globals,
+	// sharing the heap and the compiled scripts of this instance.
+	// The default context is named "".
+	// CreateContext returns false if the context already exists.
+	CreateContext(name string) bool
+
+	// SelectContext selects the context named 'name' for Eval and Call.
+	// SelectContext returns false if there is no such context.
+	SelectContext(name string) bool
+
+	// DisposeContext disposes the context named 'name', selecting the default context if it is selected.
+	// DisposeContext returns false if there is no such context or 'name' is the default context.
+	DisposeContext(name string) bool
+
+	// RegisterFunction defines a global JavaScript function 'name' which calls 'fun'.
+	// The arguments and the result are marshalled/unmarshalled by using JSON.
+	// If 'fun' returns an error, it is thrown to JavaScript as an Error.
+	RegisterFunction(name string, fun func(args []interface{}) (interface{}, error)) bool
+
+	// AddModule adds a CommonJS module 'src', which JavaScript loads by require('name').
+	// A module is compiled once and run once for each context requiring it.
+	AddModule(name string, src string)
+
+	// SetModuleDir sets the directory which require('name') loads the file 'name' or 'name'.js from.
+	SetModuleDir(dir string)
+
+	// SetStatsEnabled enables or disables recording where the time of Eval and Call goes.
+	SetStatsEnabled(enabled bool)
+
+	// Stats returns the cumulative stats of Eval and Call.
+	Stats() Stats
+
+	// LastStats returns the stats of the last Eval or Call.
+	LastStats() Stats
+
+	// ResetStats resets the stats.
+	ResetStats()
+}
+
+// Stats holds the timings in nanoseconds and the counters of Eval and Call
+type Stats struct {
+	Calls           uint64 // number of evals and calls
+	Errors          uint64 // number of evals and calls which failed
+	BytesIn         uint64 // total size of the JavaScript code and the JSON-encoded arguments
+	BytesOut        uint64 // total size of the JSON-encoded results
+	LockWaitNs      uint64 // time spent waiting for other goroutines using the instance
+	CompileNs       uint64 // time spent compiling
+	RunNs           uint64 // time spent running JavaScript
+	JSONParseNs     uint64 // time spent decoding arguments
+	JSONStringifyNs uint64 // time spent encoding results
+	GCNs            uint64 // time spent in garbage collection, which is also included in the other timings
+}
+
+// Function is a Go interface for a JavaScript function resolved by V8.Function
+type Function interface {
+	// Call calls the JavaScript function with the given argument array 'args'
+	// and stores the result into 'res'.
+	// The arguments and the result are marshalled/unmarshalled by using JSON.
+	// If the result is undefined, 'res' is not changed.
+	// If some JavaScript exception happens in runtime, Call returns the exception as a Go error.
+	Call(args interface{}, res interface{}) error
 }
 
 type v8 struct {
-	xV8 X_V8
+	xV8           X_V8
+	hostFunctions []X_HostFunction // keeps the registered functions alive
 }
 
 // NewV8 creates a new V8 instance.
@@ -57,6 +152,45 @@ func (v *v8) Eval(src string, res interface{}) error {
 	return v.decode(v.xV8.Eval(src), res)
 }
 
+type sourceReader struct {
+	r   io.Reader
+	buf []byte
+	err error // error of r other than io.EOF
+}
+
+func (s *sourceReader) Read(chunk X_SourceChunk) bool {
+	for {
+		n, err := s.r.Read(s.buf)
+		if n > 0 {
+			chunk.SetData(string(s.buf[:n]))
+			return true
+		} else if err == io.EOF {
+			chunk.SetData("")
+			return true
+		} else if err != nil {
+			s.err = err
+			chunk.SetData(err.Error())
+			return false
+		}
+	}
+}
+
+func (v *v8) EvalReader(r io.Reader, res interface{}) error {
+	s := &sourceReader{r: r, buf: make([]byte, 64*1024)}
+	xSourceReader := NewDirectorX_SourceReader(s)
+	defer DeleteDirectorX_SourceReader(xSourceReader)
+
+	result := v.xV8.Eval_stream(xSourceReader)
+	if s.err != nil {
+		return s.err
+	}
+	return v.decode(result, res)
+}
+
+func (v *v8) EvalFile(path string, res interface{}) error {
+	return v.decode(v.xV8.Eval_file(path), res)
+}
+
 func (v *v8) Call(fun string, args interface{}, res interface{}) error {
 	as, err := json.Marshal(args)
 	if err != nil {
@@ -65,3 +199,137 @@ func (v *v8) Call(fun string, args interface{}, res interface{}) error {
 
 	return v.decode(v.xV8.Call(fun, string(as)), res)
 }
+
+func (v *v8) CallBatch(fun string, argsList interface{}, res interface{}) error {
+	as, err := json.Marshal(argsList)
+	if err != nil {
+		return err
+	}
+
+	return v.decode(v.xV8.Call_batch(fun, string(as)), res)
+}
+
+func (v *v8) Warmup(fun string, argsList interface{}, iterations int) error {
+	as, err := json.Marshal(argsList)
+	if err != nil {
+		return err
+	}
+
+	if res := v.xV8.Warmup(fun, string(as), iterations); res != "" {
+		return errors.New(res)
+	}
+	return nil
+}
+
+func (v *v8) Function(fun string) Function {
+	f := new(function)
+	f.v = v
+	f.xFunction = NewX_Function(v.xV8, fun)
+	return f
+}
+
+func (v *v8) Reset() {
+	v.xV8.Reset()
+}
+
+func (v *v8) CreateContext(name string) bool {
+	return v.xV8.Create_context(name)
+}
+
+func (v *v8) SelectContext(name string) bool {
+	return v.xV8.Select_context(name)
+}
+
+func (v *v8) DisposeContext(name string) bool {
+	return v.xV8.Dispose_context(name)
+}
+
+type hostFunction struct {
+	fun func(args []interface{}) (interface{}, error)
+}
+
+func (h *hostFunction) Call(args string, result X_HostResult) bool {
+	var as []interface{}
+	if err := json.Unmarshal([]byte(args), &as); err != nil {
+		result.SetValue(err.Error())
+		return false
+	}
+
+	res, err := h.fun(as)
+	if err != nil {
+		result.SetValue(err.Error())
+		return false
+	}
+	if res == nil {
+		result.SetValue("undefined")
+		return true
+	}
+
+	bs, err := json.Marshal(res)
+	if err != nil {
+		result.SetValue(err.Error())
+		return false
+	}
+	result.SetValue(string(bs))
+	return true
+}
+
+func (v *v8) RegisterFunction(name string, fun func(args []interface{}) (interface{}, error)) bool {
+	xHostFunction := NewDirectorX_HostFunction(&hostFunction{fun: fun})
+	v.hostFunctions = append(v.hostFunctions, xHostFunction)
+	return v.xV8.Register_function(name, xHostFunction)
+}
+
+func (v *v8) AddModule(name string, src string) {
+	v.xV8.Add_module(name, src)
+}
+
+func (v *v8) SetModuleDir(dir string) {
+	v.xV8.Set_module_dir(dir)
+}
+
+func (v *v8) SetStatsEnabled(enabled bool) {
+	v.xV8.Set_stats_enabled(enabled)
+}
+
+func newStats(xStats X_Stats) Stats {
+	defer DeleteX_Stats(xStats)
+	return Stats{
+		Calls:           xStats.GetCalls(),
+		Errors:          xStats.GetErrors(),
+		BytesIn:         xStats.GetBytes_in(),
+		BytesOut:        xStats.GetBytes_out(),
+		LockWaitNs:      xStats.GetLock_wait_ns(),
+		CompileNs:       xStats.GetCompile_ns(),
+		RunNs:           xStats.GetRun_ns(),
+		JSONParseNs:     xStats.GetJson_parse_ns(),
+		JSONStringifyNs: xStats.GetJson_stringify_ns(),
+		GCNs:            xStats.GetGc_ns(),
+	}
+}
+
+func (v *v8) Stats() Stats {
+	return newStats(v.xV8.Stats())
+}
+
+func (v *v8) LastStats() Stats {
+	return newStats(v.xV8.Last_stats())
+}
+
+func (v *v8) ResetStats() {
+	v.xV8.Reset_stats()
+}
+
+type function struct {
+	v         *v8
+	xFunction X_Function
+}
+
+func (f *function) Call(args interface{}, res interface{}) error {
+	as, err := json.Marshal(args)
+	if err != nil {
+		return err
+	}
+
+	return f.v.decode(f.xFunction.Call(string(as)), res)
+}
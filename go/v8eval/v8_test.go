@@ -1,7 +1,10 @@
 package v8eval
 
 import (
+	"errors"
+	"io"
 	"runtime"
+	"strings"
 	"testing"
 
 	"github.com/stretchr/testify/assert"
@@ -40,6 +43,30 @@ func TestEval(t *testing.T) {
 	assert.Equal(t, "json: cannot unmarshal number into Go value of type string", err.Error())
 }
 
+type brokenReader struct {
+	err error
+}
+
+func (b *brokenReader) Read(p []byte) (int, error) {
+	return 0, b.err
+}
+
+func TestEvalReader(t *testing.T) {
+	v8 := NewV8()
+
+	var i int
+	assert.Equal(t, nil, v8.EvalReader(strings.NewReader("1 + 2"), &i))
+	assert.Equal(t, 3, i)
+
+	errBroken := errors.New("broken")
+	assert.Equal(t, errBroken, v8.EvalReader(io.MultiReader(strings.NewReader("var x = 1;"), &brokenReader{errBroken}), nil))
+	var s string
+	assert.Equal(t, nil, v8.Eval("typeof x", &s))
+	assert.Equal(t, "undefined", s)
+
+	assert.NotNil(t, v8.EvalFile("/nonexistent.js", nil))
+}
+
 func TestCall(t *testing.T) {
 	v8 := NewV8()
 	v8.Eval("function inc(x) { return x + 1; }", nil)
@@ -62,6 +89,126 @@ func TestCall(t *testing.T) {
 	assert.Equal(t, "json: cannot unmarshal number into Go value of type string", err.Error())
 }
 
+func TestFunction(t *testing.T) {
+	v8 := NewV8()
+	v8.Eval("function inc(x) { return x + 1; }", nil)
+	inc := v8.Function("inc")
+
+	var i int
+	assert.Equal(t, nil, inc.Call([]int{7}, &i))
+	assert.Equal(t, 8, i)
+
+	err := v8.Function("i").Call([]int{7}, &i)
+	assert.NotNil(t, err)
+	assert.Equal(t, "TypeError: 'i' is not a function", err.Error())
+}
+
+func TestCallBatch(t *testing.T) {
+	v8 := NewV8()
+	v8.Eval("function add(x, y) { return x + y; }", nil)
+
+	var is []int
+	assert.Equal(t, nil, v8.CallBatch("add", [][]int{{1, 2}, {3, 4}}, &is))
+	assert.Equal(t, []int{3, 7}, is)
+
+	err := v8.CallBatch("add", []int{1, 2}, &is)
+	assert.NotNil(t, err)
+	assert.Equal(t, "TypeError: '1' is not an array", err.Error())
+
+	err = v8.CallBatch("a", [][]int{{1, 2}}, &is)
+	assert.NotNil(t, err)
+	assert.Equal(t, "TypeError: 'a' is not a function", err.Error())
+}
+
+func TestWarmup(t *testing.T) {
+	v8 := NewV8()
+	v8.Eval("var n = 0; function add(x, y) { n++; return x + y; }", nil)
+
+	assert.Equal(t, nil, v8.Warmup("add", [][]int{{1, 2}, {3, 4}}, 10))
+	var n int
+	assert.Equal(t, nil, v8.Eval("n", &n))
+	assert.Equal(t, 20, n)
+
+	err := v8.Warmup("a", [][]int{{1, 2}}, 1)
+	assert.NotNil(t, err)
+	assert.Equal(t, "TypeError: 'a' is not a function", err.Error())
+}
+
+func TestReset(t *testing.T) {
+	v8 := NewV8()
+	v8.Eval("var x = 1;", nil)
+
+	var s string
+	v8.Reset()
+	assert.Equal(t, nil, v8.Eval("typeof x", &s))
+	assert.Equal(t, "undefined", s)
+}
+
+func TestContexts(t *testing.T) {
+	v8 := NewV8()
+	v8.Eval("var x = 1;", nil)
+	assert.True(t, v8.CreateContext("a"))
+	assert.True(t, v8.SelectContext("a"))
+
+	var s string
+	assert.Equal(t, nil, v8.Eval("typeof x", &s))
+	assert.Equal(t, "undefined", s)
+
+	var i int
+	assert.True(t, v8.DisposeContext("a"))
+	assert.Equal(t, nil, v8.Eval("x", &i))
+	assert.Equal(t, 1, i)
+	assert.False(t, v8.SelectContext("a"))
+}
+
+func TestStats(t *testing.T) {
+	v8 := NewV8()
+	v8.SetStatsEnabled(true)
+	v8.Eval("function add(x, y) { return x + y; }", nil)
+
+	var i int
+	assert.Equal(t, nil, v8.Call("add", []int{1, 2}, &i))
+	assert.Equal(t, uint64(5), v8.LastStats().BytesIn)
+
+	stats := v8.Stats()
+	assert.Equal(t, uint64(2), stats.Calls)
+	assert.Equal(t, uint64(0), stats.Errors)
+
+	v8.ResetStats()
+	assert.Equal(t, uint64(0), v8.Stats().Calls)
+}
+
+func TestRegisterFunction(t *testing.T) {
+	v8 := NewV8()
+	assert.True(t, v8.RegisterFunction("add", func(args []interface{}) (interface{}, error) {
+		if len(args) != 2 {
+			return nil, errors.New("two arguments required")
+		}
+		return args[0].(float64) + args[1].(float64), nil
+	}))
+
+	var i int
+	assert.Equal(t, nil, v8.Eval("add(1, 2)", &i))
+	assert.Equal(t, 3, i)
+
+	err := v8.Eval("add(1)", nil)
+	assert.NotNil(t, err)
+	assert.Equal(t, "Error: two arguments required", err.Error())
+}
+
+func TestModules(t *testing.T) {
+	v8 := NewV8()
+	v8.AddModule("add", "module.exports = function (x, y) { return x + y; };")
+
+	var i int
+	assert.Equal(t, nil, v8.Eval("require('add')(1, 2)", &i))
+	assert.Equal(t, 3, i)
+
+	err := v8.Eval("require('none')", nil)
+	assert.NotNil(t, err)
+	assert.Equal(t, "Error: Cannot find module 'none'", err.Error())
+}
+
 func TestInParallel(t *testing.T) {
 	numCPU := runtime.NumCPU()
 	runtime.GOMAXPROCS(numCPU)
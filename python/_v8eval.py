@@ -1,5 +1,6 @@
 # the following is appended to swig-generated file including _V8
 import json
+import os
 
 
 class V8Error(Exception):
@@ -19,6 +20,7 @@ class V8:
     """Represents a V8 instance."""
     def __init__(self):
         self._v8 = _V8()
+        self._host_functions = []  # keeps the registered functions alive
 
     def eval(self, src):
         """Evaluates JavaScript code.
@@ -47,6 +49,60 @@ class V8:
             except ValueError:
                 raise V8Error(res)
 
+    def eval_stream(self, stream):
+        """Evaluates JavaScript code read from a file-like object.
+
+        The code is parsed while it is being read.
+
+        Args:
+            stream: File-like object whose read(size) returns JavaScript code.
+
+        Returns:
+            The result of the JavaScript code.
+            The result is marshalled/unmarshalled by using JSON.
+
+        Raises:
+            V8Error: If some JavaScript exception happens.
+
+            Exception: If reading the stream raises it.
+        """
+        reader = _PySourceReader(stream)
+        res = self._v8.eval_stream(reader)
+        if reader.error is not None:
+            raise reader.error
+        return self._decode(res)
+
+    def eval_file(self, path):
+        """Evaluates a JavaScript file.
+
+        The code is parsed while it is being read.
+
+        Args:
+            path (str): Path of a JavaScript file.
+
+        Returns:
+            The result of the JavaScript code.
+            The result is marshalled/unmarshalled by using JSON.
+
+        Raises:
+            TypeError: If path is not a string.
+
+            V8Error: If some JavaScript exception happens.
+        """
+        if not isinstance(path, basestring):
+            raise TypeError('path not string')
+
+        return self._decode(self._v8.eval_file(path))
+
+    def _decode(self, res):
+        if res == 'undefined':
+            return None
+        else:
+            try:
+                return json.loads(res)
+            except ValueError:
+                raise V8Error(res)
+
     def call(self, func, args):
         """Calls a JavaScript function.
 
@@ -79,6 +135,301 @@ class V8:
             except ValueError:
                 raise V8Error(res)
 
+    def function(self, func):
+        """Resolves a JavaScript function once for repeated calls.
+
+        Args:
+            func (str): Name of a JavaScript function.
+
+        Returns:
+            Function: The resolved function.
+
+        Raises:
+            TypeError: If func is not a string.
+        """
+        if not isinstance(func, basestring):
+            raise TypeError('function name not string')
+
+        return Function(self, func)
+
+    def call_batch(self, func, args_list):
+        """Calls a JavaScript function once for each argument list.
+
+        Args:
+            func (str): Name of a JavaScript function.
+
+            args_list (list): List of argument lists to pass.
+
+        Returns:
+            The list of the results of the JavaScript function.
+            The arguments and the results are marshalled/unmarshalled by using JSON.
+
+        Raises:
+            TypeError: If either func is not a string or args_list is not a list of lists.
+
+            V8Error: If some JavaScript exception happens.
+        """
+        if not isinstance(func, basestring):
+            raise TypeError('function name not string')
+        if not isinstance(args_list, list) or \
+                not all(isinstance(args, list) for args in args_list):
+            raise TypeError('arguments not list of lists')
+
+        args_str = json.dumps(args_list)
+        res = self._v8.call_batch(func, args_str)
+        try:
+            return json.loads(res)
+        except ValueError:
+            raise V8Error(res)
+
+    def warmup(self, func, args_list, iterations=1):
+        """Warms up a JavaScript function with sample argument lists.
+
+        The function is called iterations times with each argument list and the results are discarded,
+        so that V8 compiles and optimizes it before the first actual call.
+
+        Args:
+            func (str): Name of a JavaScript function.
+
+            args_list (list): List of sample argument lists.
+
+            iterations (int): Number of calls with each argument list.
+
+        Raises:
+            TypeError: If either func is not a string, args_list is not a list of lists
+                       or iterations is not an integer.
+
+            V8Error: If some JavaScript exception happens.
+        """
+        if not isinstance(func, basestring):
+            raise TypeError('function name not string')
+        if not isinstance(args_list, list) or \
+                not all(isinstance(args, list) for args in args_list):
+            raise TypeError('arguments not list of lists')
+        if not isinstance(iterations, int):
+            raise TypeError('iterations not integer')
+
+        res = self._v8.warmup(func, json.dumps(args_list), iterations)
+        if res:
+            raise V8Error(res)
+
+    def register_function(self, name, func):
+        """Defines a global JavaScript function which calls a Python callable.
+
+        The arguments and the result are marshalled/unmarshalled by using JSON.
+        An exception raised by func is thrown to JavaScript as an Error.
+
+        Args:
+            name (str): Name of the JavaScript function.
+
+            func (callable): Python callable.
+
+        Raises:
+            TypeError: If either name is not a string or func is not callable.
+        """
+        if not isinstance(name, basestring):
+            raise TypeError('function name not string')
+        if not callable(func):
+            raise TypeError('function not callable')
+
+        host_function = _PyHostFunction(func)
+        self._host_functions.append(host_function)
+        self._v8.register_function(name, host_function)
+
+    def add_module(self, name, src):
+        """Adds a CommonJS module which JavaScript loads by require(name).
+
+        A module is compiled once and run once for each context requiring it.
+
+        Args:
+            name (str): Name of the module.
+
+            src (str): JavaScript code of the module.
+
+        Raises:
+            TypeError: If either name or src is not a string.
+        """
+        if not isinstance(name, basestring):
+            raise TypeError('module name not string')
+        if not isinstance(src, basestring):
+            raise TypeError('source code not string')
+
+        self._v8.add_module(name, src)
+
+    def set_module_dir(self, path):
+        """Sets the directory which require(name) loads the file name or name.js from.
+
+        Args:
+            path (str): Directory of modules.
+
+        Raises:
+            TypeError: If path is not a string.
+        """
+        if not isinstance(path, basestring):
+            raise TypeError('directory not string')
+
+        self._v8.set_module_dir(path)
+
+    def reset(self):
+        """Discards the JavaScript globals by replacing the context of this instance.
+
+        This is cheaper than creating a new V8 instance.
+        Functions resolved before the reset keep referring to the old globals.
+        """
+        self._v8.reset()
+
+    def set_stats_enabled(self, enabled):
+        """Enables or disables recording where the time of eval and call goes.
+
+        Args:
+            enabled (bool): Whether to record stats.
+        """
+        self._v8.set_stats_enabled(enabled)
+
+    def stats(self):
+        """Returns the cumulative stats of eval and call.
+
+        Returns:
+            dict: calls, errors, bytes_in, bytes_out, and the timings in nanoseconds
+            lock_wait_ns, compile_ns, run_ns, json_parse_ns, json_stringify_ns and gc_ns.
+        """
+        return _stats_dict(self._v8.stats())
+
+    def last_stats(self):
+        """Returns the stats of the last eval or call.
+
+        Returns:
+            dict: The same keys as stats.
+        """
+        return _stats_dict(self._v8.last_stats())
+
+    def reset_stats(self):
+        """Resets the stats."""
+        self._v8.reset_stats()
+
+    def create_context(self, name):
+        """Creates a named context with its own JavaScript globals.
+
+        All contexts of an instance share its heap and its compiled scripts.
+        The default context is named ''.
+
+        Args:
+            name (str): Name of the new context.
+
+        Returns:
+            bool: False if the context already exists.
+        """
+        return self._v8.create_context(name)
+
+    def select_context(self, name):
+        """Selects the context used by eval and call.
+
+        Args:
+            name (str): Name of a context.
+
+        Returns:
+            bool: False if there is no such context.
+        """
+        return self._v8.select_context(name)
+
+    def dispose_context(self, name):
+        """Disposes a named context, selecting the default context if it was selected.
+
+        Args:
+            name (str): Name of a context other than the default context.
+
+        Returns:
+            bool: False if there is no such context.
+        """
+        return self._v8.dispose_context(name)
+
+
+_STATS_KEYS = ('calls', 'errors', 'bytes_in', 'bytes_out', 'lock_wait_ns', 'compile_ns',
+               'run_ns', 'json_parse_ns', 'json_stringify_ns', 'gc_ns')
+
+
+def _stats_dict(stats):
+    return dict((key, getattr(stats, key)) for key in _STATS_KEYS)
+
+
+class _PySourceReader(_SourceReader):
+    def __init__(self, stream):
+        _SourceReader.__init__(self)
+        self._stream = stream
+        self.error = None
+
+    def read(self, chunk):
+        try:
+            data = self._stream.read(65536)
+            if data is None:
+                raise IOError('no data available from a non-blocking stream')
+            # V8 takes UTF-8 byte strings, which may end in the middle of a sequence
+            if not isinstance(data, bytes):
+                data = data.encode('utf-8')
+            chunk.data = data
+            return True
+        except Exception as e:
+            # must not propagate into V8
+            self.error = e
+            chunk.data = str(e)
+            return False
+
+
+class _PyHostFunction(_HostFunction):
+    def __init__(self, func):
+        _HostFunction.__init__(self)
+        self._func = func
+
+    def call(self, args, result):
+        try:
+            res = self._func(*json.loads(args))
+            result.value = 'undefined' if res is None else json.dumps(res)
+            return True
+        except Exception as e:
+            result.value = str(e)
+            return False
+
+
+class Function:
+    """Represents a JavaScript function resolved by V8.function.
+
+    Calling it skips the lookup of the function by name.
+    """
+    def __init__(self, v8, func):
+        self._v8 = v8  # keeps the V8 instance alive
+        self._function = _Function(v8._v8, func)
+
+    def call(self, args):
+        """Calls the JavaScript function.
+
+        Args:
+            args (list): Argument list to pass.
+
+        Returns:
+            The result of the JavaScript function.
+            The result is marshalled/unmarshalled by using JSON.
+
+        Raises:
+            TypeError: If args is not a list.
+
+            V8Error: If some JavaScript exception happens.
+        """
+        if not isinstance(args, list):
+            raise TypeError('arguments not list')
+
+        args_str = json.dumps(args)
+        res = self._function.call(args_str)
+        if res == 'undefined':
+            return None
+        else:
+            try:
+                return json.loads(res)
+            except ValueError:
+                raise V8Error(res)
+
 
 # initialize the V8 runtime environment
-initialize()
+# V8EVAL_FLAGS sets V8 flags (e.g. "--nolazy")
+# V8EVAL_THREAD_POOL_SIZE sets the number of V8's background worker threads
+set_flags(os.environ.get('V8EVAL_FLAGS', ''))
+initialize(int(os.environ.get('V8EVAL_THREAD_POOL_SIZE', '0')))
@@ -1,3 +1,4 @@
+import io
 import threading
 import unittest
 import v8eval
@@ -33,6 +34,23 @@ class V8TestCase(unittest.TestCase):
         with self.assertRaises(v8eval.V8Error):
             v8.eval("foo")
 
+    def test_eval_stream(self):
+        v8 = v8eval.V8()
+        self.assertEqual(v8.eval_stream(io.StringIO(u'1 + 2')), 3)
+
+        # a character split between chunks
+        src = u"'x" + u'\u3042' * 30000 + u"'.length"
+        self.assertEqual(v8.eval_stream(io.BytesIO(src.encode('utf-8'))), 30001)
+
+        class Broken:
+            def read(self, size):
+                raise IOError('broken')
+        with self.assertRaises(IOError):
+            v8.eval_stream(Broken())
+
+        with self.assertRaises(v8eval.V8Error):
+            v8.eval_file('/nonexistent.js')
+
     def test_call(self):
         v8 = v8eval.V8()
         v8.eval('function inc(x) { return x + 1; }')
@@ -45,6 +63,99 @@ class V8TestCase(unittest.TestCase):
         with self.assertRaises(v8eval.V8Error):
             v8.call('i', [7])
 
+    def test_function(self):
+        v8 = v8eval.V8()
+        v8.eval('function inc(x) { return x + 1; }')
+        inc = v8.function('inc')
+        self.assertEqual(inc.call([7]), 8)
+        self.assertEqual(inc.call([8]), 9)
+
+        with self.assertRaises(TypeError):
+            v8.function(None)
+        with self.assertRaises(TypeError):
+            inc.call(None)
+        with self.assertRaises(v8eval.V8Error):
+            v8.function('i').call([7])
+
+    def test_call_batch(self):
+        v8 = v8eval.V8()
+        v8.eval('function add(x, y) { return x + y; }')
+        self.assertEqual(v8.call_batch('add', [[1, 2], [3, 4]]), [3, 7])
+        self.assertEqual(v8.call_batch('add', []), [])
+
+        with self.assertRaises(TypeError):
+            v8.call_batch('add', [1, 2])
+        with self.assertRaises(v8eval.V8Error):
+            v8.call_batch('a', [[1, 2]])
+
+    def test_warmup(self):
+        v8 = v8eval.V8()
+        v8.eval('var n = 0; function add(x, y) { n++; return x + y; }')
+        v8.warmup('add', [[1, 2], [3, 4]], 10)
+        self.assertEqual(v8.eval('n'), 20)
+
+        with self.assertRaises(TypeError):
+            v8.warmup('add', [1, 2])
+        with self.assertRaises(v8eval.V8Error):
+            v8.warmup('a', [[1, 2]])
+
+    def test_reset(self):
+        v8 = v8eval.V8()
+        v8.eval('var x = 1;')
+        self.assertEqual(v8.eval('x'), 1)
+
+        v8.reset()
+        self.assertEqual(v8.eval('typeof x'), 'undefined')
+
+    def test_contexts(self):
+        v8 = v8eval.V8()
+        v8.eval('var x = 1;')
+        self.assertTrue(v8.create_context('a'))
+        self.assertTrue(v8.select_context('a'))
+        self.assertEqual(v8.eval('typeof x'), 'undefined')
+
+        self.assertTrue(v8.dispose_context('a'))
+        self.assertEqual(v8.eval('x'), 1)
+        self.assertFalse(v8.select_context('a'))
+
+    def test_stats(self):
+        v8 = v8eval.V8()
+        v8.set_stats_enabled(True)
+        v8.eval('function add(x, y) { return x + y; }')
+        v8.call('add', [1, 2])
+        self.assertEqual(v8.last_stats()['bytes_in'], 6)
+
+        stats = v8.stats()
+        self.assertEqual(stats['calls'], 2)
+        self.assertEqual(stats['errors'], 0)
+
+        v8.reset_stats()
+        self.assertEqual(v8.stats()['calls'], 0)
+
+    def test_register_function(self):
+        v8 = v8eval.V8()
+        v8.register_function('add', lambda x, y: x + y)
+        self.assertEqual(v8.eval('add(1, 2)'), 3)
+        self.assertEqual(v8.eval('add([1], [2])'), [1, 2])
+
+        def fail():
+            raise ValueError('failed')
+        v8.register_function('fail', fail)
+        with self.assertRaises(v8eval.V8Error) as cm:
+            v8.eval('fail()')
+        self.assertEqual(str(cm.exception), 'Error: failed')
+
+        with self.assertRaises(TypeError):
+            v8.register_function('add', None)
+
+    def test_modules(self):
+        v8 = v8eval.V8()
+        v8.add_module('add', 'module.exports = function (x, y) { return x + y; };')
+        self.assertEqual(v8.eval("require('add')(1, 2)"), 3)
+
+        with self.assertRaises(v8eval.V8Error):
+            v8.eval("require('none')")
+
     def test_multithreading(self):
         thread1 = V8Thread(self, 10000)
         thread2 = V8Thread(self, 10000)
@@ -1,7 +1,7 @@
 #!/usr/bin/env python
 
 from distutils.core import setup, Extension
-from os import system
+from os import environ, system
 from os.path import abspath, dirname, exists
 from sys import platform
 
@@ -33,6 +33,9 @@ if platform == "linux" or platform == "linux2":
 elif platform == "darwin":
     library_dirs += [v8_dir + '/out/x64.release']
 
+# link V8 with its built-in startup snapshot if V8EVAL_SNAPSHOT is set
+v8_snapshot = 'v8_snapshot' if environ.get('V8EVAL_SNAPSHOT') else 'v8_nosnapshot'
+
 v8eval_module = Extension(
     '_v8eval',
     sources=[v8eval_root + '/python/v8eval/v8eval_wrap.cxx'],
@@ -40,7 +43,7 @@ v8eval_module = Extension(
                'v8_libplatform',
                'v8_base',
                'v8_libbase',
-               'v8_nosnapshot',
+               v8_snapshot,
                'icui18n',
                'icuuc',
                'icudata'],
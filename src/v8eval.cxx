@@ -1,27 +1,147 @@
 #include "v8eval.h"
 
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <list>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
 
 #include "libplatform/libplatform.h"
 
 namespace v8eval {
 
+// Terminates script executions that run past their deadlines.
+class Watchdog {
+ public:
+  Watchdog() : stop_(false), next_id_(1), thread_(&Watchdog::run, this) {}
+
+  ~Watchdog() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+    }
+    changed_.notify_one();
+    thread_.join();
+  }
+
+  // 'fired' is set just before the execution on 'isolate' is terminated
+  uint64_t start(v8::Isolate* isolate, std::chrono::steady_clock::time_point deadline, std::atomic<bool>* fired) {
+    uint64_t id;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      id = next_id_++;
+      Watch& watch = watches_[id];
+      watch.isolate = isolate;
+      watch.deadline = deadline;
+      watch.fired = fired;
+    }
+    changed_.notify_one();
+    return id;
+  }
+
+  // after this returns, the watch with 'id' never fires
+  void stop(uint64_t id) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    watches_.erase(id);
+  }
+
+ private:
+  struct Watch {
+    v8::Isolate* isolate;
+    std::chrono::steady_clock::time_point deadline;
+    std::atomic<bool>* fired;
+  };
+
+  void run() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (!stop_) {
+      std::map<uint64_t, Watch>::iterator next = watches_.end();
+      for (std::map<uint64_t, Watch>::iterator it = watches_.begin(); it != watches_.end(); ++it) {
+        if (next == watches_.end() || it->second.deadline < next->second.deadline) {
+          next = it;
+        }
+      }
+
+      if (next == watches_.end()) {
+        changed_.wait(lock);
+      } else if (next->second.deadline <= std::chrono::steady_clock::now()) {
+        *next->second.fired = true;
+        next->second.isolate->TerminateExecution();
+        watches_.erase(next);
+      } else {
+        // stop() may erase the watch while the lock is released
+        std::chrono::steady_clock::time_point deadline = next->second.deadline;
+        changed_.wait_until(lock, deadline);
+      }
+    }
+  }
+
+  bool stop_;
+  uint64_t next_id_;
+  std::map<uint64_t, Watch> watches_;
+  std::mutex mutex_;
+  std::condition_variable changed_;
+  std::thread thread_;
+};
+
 static v8::Platform* platform = nullptr;
+static bool owns_platform = false;
+static Watchdog* watchdog = nullptr;
+
+void set_flags(const std::string& flags) {
+  v8::V8::SetFlagsFromString(flags.c_str(), static_cast<int>(flags.size()));
+}
 
-bool initialize() {
+bool initialize(int thread_pool_size) {
   if (platform) {
     return false;
   }
 
+  v8::Platform* default_platform = v8::platform::CreateDefaultPlatform(thread_pool_size);
+  if (!initialize(default_platform)) {
+    delete default_platform;
+    return false;
+  }
+
+  owns_platform = true;
+  return true;
+}
+
+bool initialize(v8::Platform* custom_platform) {
+  if (platform || !custom_platform) {
+    return false;
+  }
+
   if (!v8::V8::InitializeICU()) {
     return false;
   }
 
-  platform = v8::platform::CreateDefaultPlatform();
+  platform = custom_platform;
+  owns_platform = false;
   v8::V8::InitializePlatform(platform);
 
-  return v8::V8::Initialize();
+  watchdog = new Watchdog();
+
+  if (!v8::V8::Initialize()) {
+    // leave nothing behind, as the caller may delete the platform and try again
+    delete watchdog;
+    watchdog = nullptr;
+    v8::V8::ShutdownPlatform();
+    platform = nullptr;
+    return false;
+  }
+  return true;
 }
 
 bool dispose() {
@@ -29,20 +149,48 @@ bool dispose() {
     return false;
   }
 
+  delete watchdog;
+  watchdog = nullptr;
+
   v8::V8::Dispose();
 
   v8::V8::ShutdownPlatform();
-  delete platform;
+  if (owns_platform) {
+    delete platform;
+  }
   platform = nullptr;
 
   return true;
 }
 
+static std::mutex snapshot_mutex;
+static std::shared_ptr<const std::string> snapshot;
+
+std::string create_snapshot(const std::string& src) {
+  v8::StartupData data = v8::V8::CreateSnapshotDataBlob(src.c_str());
+  if (!data.data) {
+    return "";
+  }
+
+  std::string blob(data.data, data.raw_size);
+  delete[] data.data;
+  return blob;
+}
+
+void set_snapshot(const std::string& data) {
+  std::lock_guard<std::mutex> lock(snapshot_mutex);
+  if (data.empty()) {
+    snapshot.reset();
+  } else {
+    snapshot = std::make_shared<const std::string>(data);
+  }
+}
+
 class ArrayBufferAllocator : public v8::ArrayBuffer::Allocator {
  public:
   virtual void* Allocate(size_t length) {
-    void* data = AllocateUninitialized(length);
-    return data == NULL ? data : memset(data, 0, length);
+    // unlike malloc and memset, calloc does not touch fresh pages which the OS already zeroed
+    return calloc(length, 1);
   }
 
   virtual void* AllocateUninitialized(size_t length) {
@@ -54,131 +202,2359 @@ class ArrayBufferAllocator : public v8::ArrayBuffer::Allocator {
   }
 };
 
-static ArrayBufferAllocator allocator;
+static ArrayBufferAllocator default_allocator;
+static std::mutex allocator_mutex;
+static v8::ArrayBuffer::Allocator* allocator = &default_allocator;
 
-_V8::_V8() {
-  v8::Isolate::CreateParams create_params;
-  create_params.array_buffer_allocator = &allocator;
-  isolate_ = v8::Isolate::New(create_params);
+void set_array_buffer_allocator(v8::ArrayBuffer::Allocator* array_buffer_allocator) {
+  std::lock_guard<std::mutex> lock(allocator_mutex);
+  allocator = array_buffer_allocator ? array_buffer_allocator : &default_allocator;
+}
 
-  v8::Locker locker(isolate_);
+static const size_t kMinPooledSize = 16;
 
-  v8::Isolate::Scope isolate_scope(isolate_);
-  v8::HandleScope handle_scope(isolate_);
-  context_.Reset(isolate_, new_context());
+ArrayBufferPool::ArrayBufferPool(size_t max_cached_bytes) : cached_bytes_(0), max_cached_bytes_(max_cached_bytes) {}
+
+ArrayBufferPool::~ArrayBufferPool() {
+  for (int i = 0; i < kNumSizeClasses; i++) {
+    for (void* data : free_lists_[i]) {
+      free(data);
+    }
+  }
 }
 
-_V8::~_V8() {
-  context_.Reset();
+// returns -1 for sizes which are not pooled
+int ArrayBufferPool::size_class(size_t length) {
+  int i = 0;
+  for (size_t size = kMinPooledSize; size < length; size <<= 1) {
+    if (++i == kNumSizeClasses) {
+      return -1;
+    }
+  }
+  return i;
+}
 
-  isolate_->Dispose();
+void* ArrayBufferPool::pop(int size_class) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::vector<void*>& free_list = free_lists_[size_class];
+  if (free_list.empty()) {
+    return nullptr;
+  }
+
+  void* data = free_list.back();
+  free_list.pop_back();
+  cached_bytes_ -= kMinPooledSize << size_class;
+  return data;
 }
 
-v8::Local<v8::Context> _V8::new_context() {
-  if (context_.IsEmpty()) {
-    v8::Local<v8::ObjectTemplate> global = v8::ObjectTemplate::New(isolate_);
-    return v8::Context::New(isolate_, nullptr, global);
-  } else {
-    return v8::Local<v8::Context>::New(isolate_, context_);
+void* ArrayBufferPool::Allocate(size_t length) {
+  int i = size_class(length);
+  if (i < 0) {
+    return calloc(length, 1);
+  }
+
+  void* data = pop(i);
+  return data ? memset(data, 0, length) : calloc(kMinPooledSize << i, 1);
+}
+
+void* ArrayBufferPool::AllocateUninitialized(size_t length) {
+  int i = size_class(length);
+  if (i < 0) {
+    return malloc(length);
   }
+
+  void* data = pop(i);
+  return data ? data : malloc(kMinPooledSize << i);
 }
 
-v8::Local<v8::String> _V8::new_string(const char* str) {
-  return v8::String::NewFromUtf8(isolate_, str ? str : "", v8::NewStringType::kNormal).ToLocalChecked();
+void ArrayBufferPool::Free(void* data, size_t length) {
+  int i = size_class(length);
+  if (i >= 0 && data) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    size_t size = kMinPooledSize << i;
+    if (cached_bytes_ + size <= max_cached_bytes_) {
+      free_lists_[i].push_back(data);
+      cached_bytes_ += size;
+      return;
+    }
+  }
+  free(data);
 }
 
-static std::string to_std_string(v8::Local<v8::Value> value) {
-  v8::String::Utf8Value str(value);
-  return *str ? *str : "Error: Cannot convert to string";
+size_t ArrayBufferPool::cached_bytes() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return cached_bytes_;
 }
 
-v8::Local<v8::Value> _V8::json_parse(v8::Local<v8::Context> context, v8::Local<v8::String> str) {
-  v8::Local<v8::Object> global = context->Global();
-  v8::Local<v8::Object> json = global->Get(context, new_string("JSON")).ToLocalChecked()->ToObject();
-  v8::Local<v8::Function> parse = v8::Local<v8::Function>::Cast(json->Get(context, new_string("parse")).ToLocalChecked());
+// Counts the ArrayBuffer memory of an isolate and enforces its limit
+class AccountingAllocator : public v8::ArrayBuffer::Allocator {
+ public:
+  explicit AccountingAllocator(v8::ArrayBuffer::Allocator* allocator) : allocator_(allocator), bytes_(0), limit_(0) {}
 
-  v8::Local<v8::Value> result;
-  v8::Local<v8::Value> value = str;
-  if (!parse->Call(context, json, 1, &value).ToLocal(&result)) {
-    return v8::Local<v8::Value>();  // empty
-  } else {
-    return result;
+  virtual void* Allocate(size_t length) {
+    return reserve(length) ? commit(allocator_->Allocate(length), length) : nullptr;
+  }
+
+  virtual void* AllocateUninitialized(size_t length) {
+    return reserve(length) ? commit(allocator_->AllocateUninitialized(length), length) : nullptr;
+  }
+
+  virtual void Free(void* data, size_t length) {
+    allocator_->Free(data, length);
+    bytes_ -= length;
+  }
+
+  void set_limit(size_t limit) {
+    limit_ = limit;
+  }
+
+  size_t bytes() const {
+    return bytes_;
+  }
+
+ private:
+  bool reserve(size_t length) {
+    size_t limit = limit_;
+    if (bytes_.fetch_add(length) + length > limit && limit > 0) {
+      bytes_ -= length;
+      return false;
+    }
+    return true;
   }
+
+  void* commit(void* data, size_t length) {
+    if (!data) {
+      bytes_ -= length;
+    }
+    return data;
+  }
+
+ private:
+  v8::ArrayBuffer::Allocator* allocator_;
+  std::atomic<size_t> bytes_;
+  std::atomic<size_t> limit_;
+};
+
+Value::Value() : type_(kUndefined), boolean_(false), number_(0) {}
+
+Value::Value(bool boolean) : type_(kBoolean), boolean_(boolean), number_(0) {}
+
+Value::Value(int number) : type_(kNumber), boolean_(false), number_(number) {}
+
+Value::Value(double number) : type_(kNumber), boolean_(false), number_(number) {}
+
+Value::Value(const char* str) : type_(kString), boolean_(false), number_(0), string_(str ? str : "") {}
+
+Value::Value(const std::string& str) : type_(kString), boolean_(false), number_(0), string_(str) {}
+
+Value::Value(const Array& array) : type_(kArray), boolean_(false), number_(0), array_(array) {}
+
+Value::Value(const Object& object) : type_(kObject), boolean_(false), number_(0), object_(object) {}
+
+Value Value::null() {
+  Value value;
+  value.type_ = kNull;
+  return value;
 }
 
-v8::Local<v8::String> _V8::json_stringify(v8::Local<v8::Context> context, v8::Local<v8::Value> value) {
-  v8::Local<v8::Object> global = context->Global();
-  v8::Local<v8::Object> json = global->Get(context, new_string("JSON")).ToLocalChecked()->ToObject();
-  v8::Local<v8::Function> stringify = v8::Local<v8::Function>::Cast(json->Get(context, new_string("stringify")).ToLocalChecked());
+bool Value::operator==(const Value& other) const {
+  if (type_ != other.type_) {
+    return false;
+  }
 
-  v8::Local<v8::Value> result;
-  if (!stringify->Call(context, json, 1, &value).ToLocal(&result)) {
-    return new_string("");
-  } else {
-    return result->ToString();
+  switch (type_) {
+    case kBoolean:
+      return boolean_ == other.boolean_;
+    case kNumber:
+      return number_ == other.number_;
+    case kString:
+      return string_ == other.string_;
+    case kArray:
+      return array_ == other.array_;
+    case kObject:
+      return object_ == other.object_;
+    default:
+      return true;
   }
 }
 
-std::string _V8::eval(const std::string& src) {
+// 64-bit FNV-1a
+static uint64_t hash_source(const std::string& src) {
+  uint64_t hash = 14695981039346656037ULL;
+  for (size_t i = 0; i < src.size(); i++) {
+    hash ^= static_cast<unsigned char>(src[i]);
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+// invalid sequences are replaced with U+FFFD
+static void utf8_to_utf16(const std::string& src, std::vector<uint16_t>* dst) {
+  dst->clear();
+  dst->reserve(src.size());
+
+  size_t i = 0;
+  while (i < src.size()) {
+    unsigned char c = static_cast<unsigned char>(src[i]);
+    uint32_t code_point;
+    size_t length;
+    if (c < 0x80) {
+      code_point = c;
+      length = 1;
+    } else if ((c & 0xe0) == 0xc0) {
+      code_point = c & 0x1f;
+      length = 2;
+    } else if ((c & 0xf0) == 0xe0) {
+      code_point = c & 0x0f;
+      length = 3;
+    } else if ((c & 0xf8) == 0xf0) {
+      code_point = c & 0x07;
+      length = 4;
+    } else {
+      code_point = 0xfffd;
+      length = 0;
+    }
+
+    size_t j = 1;
+    for (; j < length && i + j < src.size(); j++) {
+      unsigned char cc = static_cast<unsigned char>(src[i + j]);
+      if ((cc & 0xc0) != 0x80) {
+        break;
+      }
+      code_point = (code_point << 6) | (cc & 0x3f);
+    }
+
+    if (length == 0 || j < length) {
+      dst->push_back(0xfffd);
+      i += j;
+    } else if (code_point >= 0x10000) {
+      code_point -= 0x10000;
+      dst->push_back(static_cast<uint16_t>(0xd800 | (code_point >> 10)));
+      dst->push_back(static_cast<uint16_t>(0xdc00 | (code_point & 0x3ff)));
+      i += length;
+    } else {
+      dst->push_back(static_cast<uint16_t>(code_point));
+      i += length;
+    }
+  }
+}
+
+Source::Source(const std::string& src) : src_(std::make_shared<const std::string>(src)), one_byte_(true) {
+  init();
+}
+
+Source::Source(std::string&& src) : src_(std::make_shared<const std::string>(std::move(src))), one_byte_(true) {
+  init();
+}
+
+void Source::init() {
+  hash_ = hash_source(*src_);
+  for (size_t i = 0; i < src_->size(); i++) {
+    if (static_cast<unsigned char>((*src_)[i]) >= 0x80) {
+      one_byte_ = false;
+      break;
+    }
+  }
+
+  // ASCII is handed to V8 in place; anything else is transcoded once for all the isolates
+  if (!one_byte_) {
+    utf8_to_utf16(*src_, &two_byte_);
+  }
+}
+
+// These resources keep their Source alive until V8 disposes of the external string.
+class ExternalOneByteSource : public v8::String::ExternalOneByteStringResource {
+ public:
+  explicit ExternalOneByteSource(const std::shared_ptr<const Source>& source) : source_(source) {}
+
+  virtual const char* data() const {
+    return source_->str().data();
+  }
+
+  virtual size_t length() const {
+    return source_->str().size();
+  }
+
+ private:
+  std::shared_ptr<const Source> source_;
+};
+
+class ExternalTwoByteSource : public v8::String::ExternalStringResource {
+ public:
+  explicit ExternalTwoByteSource(const std::shared_ptr<const Source>& source) : source_(source) {}
+
+  virtual const uint16_t* data() const {
+    return source_->two_byte_.data();
+  }
+
+  virtual size_t length() const {
+    return source_->two_byte_.size();
+  }
+
+ private:
+  std::shared_ptr<const Source> source_;
+};
+
+static const size_t kDefaultScriptCacheCapacity = 64;
+
+// LRU cache of context-independent compiled scripts.
+// It must be used while holding the lock of the isolate that owns the scripts.
+class ScriptCache {
+ public:
+  explicit ScriptCache(size_t capacity) : capacity_(capacity), hits_(0), misses_(0) {}
+
+  ~ScriptCache() {
+    clear();
+  }
+
+  v8::Local<v8::UnboundScript> get(v8::Isolate* isolate, uint64_t hash, const std::string& src) {
+    std::unordered_map<uint64_t, EntryList::iterator>::iterator it = index_.find(hash);
+    if (it == index_.end() || (it->second->source.get() != &src && *it->second->source != src)) {
+      misses_++;
+      return v8::Local<v8::UnboundScript>();  // empty
+    }
+
+    hits_++;
+    entries_.splice(entries_.begin(), entries_, it->second);
+    return v8::Local<v8::UnboundScript>::New(isolate, it->second->script);
+  }
+
+  // 'src' is shared with the caller, e.g. a Source
+  void put(v8::Isolate* isolate, uint64_t hash, const std::shared_ptr<const std::string>& src,
+           v8::Local<v8::UnboundScript> script) {
+    if (capacity_ == 0) {
+      return;
+    }
+
+    std::unordered_map<uint64_t, EntryList::iterator>::iterator it = index_.find(hash);
+    if (it != index_.end()) {
+      erase(it->second);
+    }
+
+    entries_.emplace_front();
+    Entry& entry = entries_.front();
+    entry.hash = hash;
+    entry.source = src;
+    entry.script.Reset(isolate, script);
+    index_[hash] = entries_.begin();
+
+    shrink();
+  }
+
+  void set_capacity(size_t capacity) {
+    capacity_ = capacity;
+    shrink();
+  }
+
+  void clear() {
+    while (!entries_.empty()) {
+      erase(--entries_.end());
+    }
+  }
+
+  bool enabled() const { return capacity_ > 0; }
+  size_t hits() const { return hits_; }
+  size_t misses() const { return misses_; }
+
+ private:
+  struct Entry {
+    uint64_t hash;
+    std::shared_ptr<const std::string> source;
+    v8::Persistent<v8::UnboundScript> script;
+  };
+
+  typedef std::list<Entry> EntryList;
+
+  void erase(EntryList::iterator entry) {
+    index_.erase(entry->hash);
+    entry->script.Reset();
+    entries_.erase(entry);
+  }
+
+  void shrink() {
+    while (entries_.size() > capacity_) {
+      erase(--entries_.end());
+    }
+  }
+
+  size_t capacity_;
+  size_t hits_;
+  size_t misses_;
+  EntryList entries_;  // most recently used first
+  std::unordered_map<uint64_t, EntryList::iterator> index_;
+};
+
+_V8::_V8(int max_old_space_size, int max_semi_space_size)
+    : timeout_ms_(0),
+      heap_limit_reached_(false),
+      old_space_limit_(0),
+      await_promises_(false),
+      stats_enabled_(false),
+      gc_start_ns_(0),
+      gc_ns_(0),
+      modules_enabled_(false) {
+  script_cache_ = new ScriptCache(kDefaultScriptCacheCapacity);
+
+  {
+    std::lock_guard<std::mutex> lock(allocator_mutex);
+    allocator_ = new AccountingAllocator(allocator);
+  }
+
+  v8::Isolate::CreateParams create_params;
+  create_params.array_buffer_allocator = allocator_;
+  if (max_old_space_size > 0) {
+    create_params.constraints.set_max_old_space_size(max_old_space_size);
+  }
+  if (max_semi_space_size > 0) {
+    create_params.constraints.set_max_semi_space_size(max_semi_space_size);
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(snapshot_mutex);
+    snapshot_ = snapshot;
+  }
+  if (snapshot_) {
+    // the isolate deserializes contexts from this data until it is disposed
+    startup_data_.data = snapshot_->data();
+    startup_data_.raw_size = static_cast<int>(snapshot_->size());
+    create_params.snapshot_blob = &startup_data_;
+  }
+
+  isolate_ = v8::Isolate::New(create_params);
+  isolate_->SetData(0, this);
+  isolate_->AddGCPrologueCallback(gc_prologue);
+  isolate_->AddGCEpilogueCallback(gc_epilogue);
+  if (max_old_space_size > 0) {
+    old_space_limit_ = static_cast<size_t>(max_old_space_size) * 1024 * 1024;
+  } else if (max_semi_space_size > 0) {
+    // the heap reserves 4 semi-spaces besides the old generation
+    v8::HeapStatistics heap_statistics;
+    isolate_->GetHeapStatistics(&heap_statistics);
+    old_space_limit_ =
+        heap_statistics.heap_size_limit() - static_cast<size_t>(max_semi_space_size) * 4 * 1024 * 1024;
+  }
+  if (old_space_limit_ > 0) {
+    isolate_->AddGCEpilogueCallback(check_heap_limit, v8::kGCTypeMarkSweepCompact);
+  }
+
   v8::Locker locker(isolate_);
 
   v8::Isolate::Scope isolate_scope(isolate_);
   v8::HandleScope handle_scope(isolate_);
 
   v8::Local<v8::Context> context = new_context();
-  v8::Context::Scope context_scope(context);
+  contexts_[context_name_].Reset(isolate_, context);
+  context_.Reset(isolate_, context);
+}
 
-  v8::TryCatch try_catch(isolate_);
+_V8::~_V8() {
+  delete script_cache_;
+  for (auto& entry : buffers_) {
+    entry.second.Reset();
+  }
+  for (auto& entry : contexts_) {
+    entry.second.Reset();
+  }
+  for (auto& entry : compiled_modules_) {
+    entry.second.Reset();
+  }
+  context_.Reset();
 
-  v8::Local<v8::String> source = new_string(src.c_str());
+  isolate_->Dispose();
+  delete allocator_;
+}
 
-  v8::Local<v8::String> name = new_string("v8eval");
-  v8::ScriptOrigin origin(name);
+void _V8::reset() {
+  v8::Locker locker(isolate_);
 
-  v8::Local<v8::Script> script;
-  if (!v8::Script::Compile(context, source, &origin).ToLocal(&script)) {
-    return to_std_string(try_catch.Exception());
-  } else {
-    v8::Local<v8::Value> result;
-    if (!script->Run(context).ToLocal(&result)) {
-      return to_std_string(try_catch.Exception());
-    } else {
-      return to_std_string(json_stringify(context, result));
-    }
-  }
+  v8::Isolate::Scope isolate_scope(isolate_);
+  v8::HandleScope handle_scope(isolate_);
+
+  release_buffers(context_name_);
+
+  v8::Local<v8::Context> context = new_context();
+  contexts_[context_name_].Reset(isolate_, context);
+  context_.Reset(isolate_, context);
+  isolate_->ContextDisposedNotification();
 }
 
-std::string _V8::call(const std::string& func, const std::string& args) {
+bool _V8::create_context(const std::string& name) {
+  if (contexts_.count(name) > 0) {
+    return false;
+  }
+
   v8::Locker locker(isolate_);
 
   v8::Isolate::Scope isolate_scope(isolate_);
   v8::HandleScope handle_scope(isolate_);
 
-  v8::Local<v8::Context> context = new_context();
-  v8::Context::Scope context_scope(context);
+  contexts_[name].Reset(isolate_, new_context());
+  return true;
+}
 
-  v8::TryCatch try_catch(isolate_);
+bool _V8::select_context(const std::string& name) {
+  auto it = contexts_.find(name);
+  if (it == contexts_.end()) {
+    return false;
+  }
 
-  v8::Local<v8::Object> global = context->Global();
-  v8::Local<v8::Value> result;
-  if (!global->Get(context, new_string(func.c_str())).ToLocal(&result)) {
-    return to_std_string(try_catch.Exception());
-  } else if (!result->IsFunction()) {
-    return "TypeError: '" + func + "' is not a function";
+  v8::Locker locker(isolate_);
+
+  v8::Isolate::Scope isolate_scope(isolate_);
+  v8::HandleScope handle_scope(isolate_);
+
+  context_.Reset(isolate_, it->second);
+  context_name_ = name;
+  return true;
+}
+
+bool _V8::dispose_context(const std::string& name) {
+  auto it = contexts_.find(name);
+  if (name.empty() || it == contexts_.end()) {
+    return false;
   }
 
-  v8::Local<v8::Function> function = v8::Handle<v8::Function>::Cast(result);
-  v8::Local<v8::Function> apply = v8::Handle<v8::Function>::Cast(function->Get(context, new_string("apply")).ToLocalChecked());
-  v8::Local<v8::Value> arguments = json_parse(context, new_string(args.c_str()));
-  if (arguments.IsEmpty() || !arguments->IsArray()) {
-    return "TypeError: '" + args + "' is not an array";
+  if (name == context_name_) {
+    select_context("");
   }
 
-  v8::Local<v8::Value> values[] = { function, arguments };
-  if (!apply->Call(context, function, 2, values).ToLocal(&result)) {
-    return to_std_string(try_catch.Exception());
-  } else {
-    return to_std_string(json_stringify(context, result));
+  v8::Locker locker(isolate_);
+
+  v8::Isolate::Scope isolate_scope(isolate_);
+  v8::HandleScope handle_scope(isolate_);
+
+  release_buffers(name);
+  it->second.Reset();
+  contexts_.erase(it);
+  isolate_->ContextDisposedNotification();
+  return true;
+}
+
+std::string _V8::context_name() const {
+  return context_name_;
+}
+
+// Terminates the running script when a full GC cannot bring the heap usage
+// below 90% of the limit, instead of letting V8 abort the process on OOM.
+void _V8::check_heap_limit(v8::Isolate* isolate, v8::GCType type, v8::GCCallbackFlags flags) {
+  _V8* v8 = static_cast<_V8*>(isolate->GetData(0));
+  if (v8->heap_limit_reached_) {
+    return;
+  }
+
+  // heap_size_limit() also counts the reserved new space, so the old generation is compared with its own limit
+  size_t old_space_used = 0;
+  for (size_t i = 0; i < isolate->NumberOfHeapSpaces(); i++) {
+    v8::HeapSpaceStatistics space_statistics;
+    if (isolate->GetHeapSpaceStatistics(&space_statistics, i) &&
+        strcmp(space_statistics.space_name(), "new_space") != 0) {
+      old_space_used += space_statistics.space_used_size();
+    }
+  }
+
+  if (old_space_used > v8->old_space_limit_ / 10 * 9) {
+    v8->heap_limit_reached_ = true;
+    isolate->TerminateExecution();
+  }
+}
+
+// Embedder data slots of the JSON functions cached in each context, and of its loaded modules.
+// The slot 0 is left to V8's debugger.
+enum {
+  kJSONIndex = 1,
+  kJSONParseIndex,
+  kJSONStringifyIndex,
+  kModulesIndex,
+};
+
+static uint64_t now_ns() {
+  return static_cast<uint64_t>(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+void _V8::gc_prologue(v8::Isolate* isolate, v8::GCType type, v8::GCCallbackFlags flags) {
+  _V8* v8 = static_cast<_V8*>(isolate->GetData(0));
+  if (v8->stats_enabled_) {
+    v8->gc_start_ns_ = now_ns();
+  }
+}
+
+void _V8::gc_epilogue(v8::Isolate* isolate, v8::GCType type, v8::GCCallbackFlags flags) {
+  _V8* v8 = static_cast<_V8*>(isolate->GetData(0));
+  if (v8->gc_start_ns_ != 0) {
+    v8->gc_ns_ += now_ns() - v8->gc_start_ns_;
+    v8->gc_start_ns_ = 0;
+  }
+}
+
+v8::Local<v8::Context> _V8::new_context() {
+  v8::Local<v8::ObjectTemplate> global = v8::ObjectTemplate::New(isolate_);
+  for (auto& entry : host_functions_) {
+    global->Set(new_string(entry.first).ToLocalChecked(), new_host_function(entry.second));
+  }
+  v8::Local<v8::Context> context = v8::Context::New(isolate_, nullptr, global);
+
+  // look up the JSON functions once instead of on every eval/call
+  v8::Context::Scope context_scope(context);
+  v8::Local<v8::Object> json = context->Global()->Get(context, new_string("JSON")).ToLocalChecked()->ToObject();
+  context->SetEmbedderData(kJSONIndex, json);
+  context->SetEmbedderData(kJSONParseIndex, json->Get(context, new_string("parse")).ToLocalChecked());
+  context->SetEmbedderData(kJSONStringifyIndex, json->Get(context, new_string("stringify")).ToLocalChecked());
+
+  if (modules_enabled_) {
+    install_require(context);
+  }
+  return context;
+}
+
+v8::Local<v8::Context> _V8::current_context() {
+  return v8::Local<v8::Context>::New(isolate_, context_);
+}
+
+v8::Local<v8::String> _V8::new_string(const char* str) {
+  return v8::String::NewFromUtf8(isolate_, str ? str : "", v8::NewStringType::kNormal).ToLocalChecked();
+}
+
+// 'str' may contain NUL characters and is not scanned for its length
+v8::MaybeLocal<v8::String> _V8::new_string(const std::string& str) {
+  v8::MaybeLocal<v8::String> result;
+  if (str.size() <= static_cast<size_t>(v8::String::kMaxLength)) {
+    result = v8::String::NewFromUtf8(isolate_, str.data(), v8::NewStringType::kNormal, static_cast<int>(str.size()));
+  }
+
+  if (result.IsEmpty()) {
+    isolate_->ThrowException(v8::Exception::RangeError(new_string("Invalid string length")));
+  }
+  return result;
+}
+
+v8::MaybeLocal<v8::String> _V8::new_external_string(const std::shared_ptr<const Source>& source) {
+  v8::MaybeLocal<v8::String> str;
+  if (source->one_byte_) {
+    ExternalOneByteSource* resource = new ExternalOneByteSource(source);
+    str = v8::String::NewExternalOneByte(isolate_, resource);
+    if (str.IsEmpty()) {
+      delete resource;
+    }
+  } else {
+    ExternalTwoByteSource* resource = new ExternalTwoByteSource(source);
+    str = v8::String::NewExternalTwoByte(isolate_, resource);
+    if (str.IsEmpty()) {
+      delete resource;
+    }
+  }
+
+  if (str.IsEmpty()) {
+    isolate_->ThrowException(v8::Exception::RangeError(new_string("Invalid string length")));
+  }
+  return str;
+}
+
+static std::string to_std_string(v8::Local<v8::Value> value) {
+  v8::String::Utf8Value str(value);
+  return *str ? std::string(*str, str.length()) : "Error: Cannot convert to string";
+}
+
+_Stats::_Stats()
+    : calls(0),
+      errors(0),
+      bytes_in(0),
+      bytes_out(0),
+      lock_wait_ns(0),
+      compile_ns(0),
+      run_ns(0),
+      json_parse_ns(0),
+      json_stringify_ns(0),
+      gc_ns(0) {}
+
+static void add_stats(_Stats* total, const _Stats& stats) {
+  total->calls += stats.calls;
+  total->errors += stats.errors;
+  total->bytes_in += stats.bytes_in;
+  total->bytes_out += stats.bytes_out;
+  total->lock_wait_ns += stats.lock_wait_ns;
+  total->compile_ns += stats.compile_ns;
+  total->run_ns += stats.run_ns;
+  total->json_parse_ns += stats.json_parse_ns;
+  total->json_stringify_ns += stats.json_stringify_ns;
+  total->gc_ns += stats.gc_ns;
+}
+
+// Records the timings and the counters of an eval or a call if the stats of its _V8 instance are enabled.
+// It is created before the isolate is locked, to measure the wait,
+// and committed by the ExecutionScope while the isolate is still locked.
+class StatsScope {
+ public:
+  // 'failed' is set if the eval or call fails
+  explicit StatsScope(_V8* v8, bool* failed = nullptr)
+      : v8_(v8),
+        failed_(failed),
+        enabled_(v8->stats_enabled_),
+        start_ns_(enabled_ ? now_ns() : 0),
+        phase_start_ns_(0),
+        gc_ns_(0) {}
+
+  void locked() {
+    if (enabled_) {
+      stats_.lock_wait_ns = now_ns() - start_ns_;
+      gc_ns_ = v8_->gc_ns_;
+    }
+  }
+
+  void start() {
+    if (enabled_) {
+      phase_start_ns_ = now_ns();
+    }
+  }
+
+  void stop(uint64_t _Stats::*phase) {
+    if (enabled_) {
+      stats_.*phase += now_ns() - phase_start_ns_;
+    }
+  }
+
+  void add_bytes(size_t bytes_in, size_t bytes_out) {
+    stats_.bytes_in += bytes_in;
+    stats_.bytes_out += bytes_out;
+  }
+
+  void fail() {
+    stats_.errors = 1;
+    if (failed_) {
+      *failed_ = true;
+    }
+  }
+
+  void commit() {
+    if (!enabled_) {
+      return;
+    }
+
+    stats_.calls = 1;
+    stats_.gc_ns = v8_->gc_ns_ - gc_ns_;
+
+    std::lock_guard<std::mutex> lock(v8_->stats_mutex_);
+    v8_->last_stats_ = stats_;
+    add_stats(&v8_->stats_, stats_);
+  }
+
+ private:
+  _V8* v8_;
+  bool* failed_;
+  bool enabled_;
+  uint64_t start_ns_;
+  uint64_t phase_start_ns_;
+  uint64_t gc_ns_;  // GC time of the instance when the isolate was locked
+  _Stats stats_;
+};
+
+// Guards a script execution.
+// It arms the watchdog for its lifetime and, on destruction, cancels a termination
+// requested by the watchdog or by the heap limit check so that the isolate can run scripts again.
+class ExecutionScope {
+ public:
+  ExecutionScope(v8::Isolate* isolate, int timeout_ms, bool* heap_limit_reached, StatsScope* stats)
+      : isolate_(isolate), heap_limit_reached_(heap_limit_reached), stats_(stats), id_(0), fired_(false) {
+    if (timeout_ms > 0 && watchdog) {
+      std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+      id_ = watchdog->start(isolate_, deadline, &fired_);
+    }
+  }
+
+  ~ExecutionScope() {
+    stats_->commit();
+
+    if (id_ != 0) {
+      watchdog->stop(id_);
+      if (fired_) {
+        isolate_->CancelTerminateExecution();
+      }
+    }
+
+    if (*heap_limit_reached_) {
+      // release what the terminated script left behind before checking the heap limit again
+      isolate_->LowMemoryNotification();
+      *heap_limit_reached_ = false;
+      isolate_->CancelTerminateExecution();
+    }
+  }
+
+  StatsScope* stats() const {
+    return stats_;
+  }
+
+  std::string error(const std::string& message) const {
+    stats_->fail();
+    return message;
+  }
+
+  // a termination is not always visible to 'try_catch', e.g. when it happens in a microtask
+  std::string exception_message(const v8::TryCatch& try_catch) const {
+    stats_->fail();
+    if (*heap_limit_reached_) {
+      return "RangeError: Heap limit reached";
+    } else if (fired_) {
+      return "TimeoutError: Script execution timed out";
+    }
+    return to_std_string(try_catch.Exception());
+  }
+
+ private:
+  v8::Isolate* isolate_;
+  bool* heap_limit_reached_;
+  StatsScope* stats_;
+  uint64_t id_;
+  std::atomic<bool> fired_;
+};
+
+v8::Local<v8::Value> _V8::json_parse(v8::Local<v8::Context> context, v8::Local<v8::String> str) {
+  v8::Local<v8::Object> json = v8::Local<v8::Object>::Cast(context->GetEmbedderData(kJSONIndex));
+  v8::Local<v8::Function> parse = v8::Local<v8::Function>::Cast(context->GetEmbedderData(kJSONParseIndex));
+
+  v8::Local<v8::Value> result;
+  v8::Local<v8::Value> value = str;
+  if (!parse->Call(context, json, 1, &value).ToLocal(&result)) {
+    return v8::Local<v8::Value>();  // empty
+  } else {
+    return result;
+  }
+}
+
+v8::Local<v8::String> _V8::json_stringify(v8::Local<v8::Context> context, v8::Local<v8::Value> value) {
+  v8::Local<v8::Object> json = v8::Local<v8::Object>::Cast(context->GetEmbedderData(kJSONIndex));
+  v8::Local<v8::Function> stringify = v8::Local<v8::Function>::Cast(context->GetEmbedderData(kJSONStringifyIndex));
+
+  v8::Local<v8::Value> result;
+  if (!stringify->Call(context, json, 1, &value).ToLocal(&result)) {
+    return new_string("");
+  } else {
+    return result->ToString();
+  }
+}
+
+_HostFunction::~_HostFunction() {}
+
+v8::Local<v8::FunctionTemplate> _V8::new_host_function(_HostFunction* function) {
+  return v8::FunctionTemplate::New(isolate_, call_host_function, v8::External::New(isolate_, function));
+}
+
+void _V8::call_host_function(const v8::FunctionCallbackInfo<v8::Value>& info) {
+  v8::Isolate* isolate = info.GetIsolate();
+  _V8* v8 = static_cast<_V8*>(isolate->GetData(0));
+  _HostFunction* function = static_cast<_HostFunction*>(v8::Local<v8::External>::Cast(info.Data())->Value());
+  v8::Local<v8::Context> context = isolate->GetCurrentContext();
+
+  v8::TryCatch try_catch(isolate);
+
+  v8::Local<v8::Array> args = v8::Array::New(isolate, info.Length());
+  bool set = true;
+  for (int i = 0; i < info.Length() && set; i++) {
+    set = args->Set(context, static_cast<uint32_t>(i), info[i]).IsJust();
+  }
+  v8::Local<v8::String> args_json = v8->json_stringify(context, args);
+  if (!set || try_catch.HasCaught()) {
+    try_catch.ReThrow();
+    return;
+  }
+
+  _HostResult result;
+  bool ok = function->call(to_std_string(args_json), &result);
+  if (ok && result.value == "undefined") {
+    return;
+  }
+
+  v8::Local<v8::String> result_string;
+  v8::Local<v8::Value> value;
+  if (!v8->new_string(result.value).ToLocal(&result_string)) {
+    try_catch.ReThrow();
+  } else if (!ok) {
+    isolate->ThrowException(v8::Exception::Error(result_string));
+  } else if (!(value = v8->json_parse(context, result_string)).IsEmpty()) {
+    info.GetReturnValue().Set(value);
+  } else {
+    try_catch.ReThrow();
+  }
+}
+
+bool _V8::register_function(const std::string& name, _HostFunction* function) {
+  v8::Locker locker(isolate_);
+
+  v8::Isolate::Scope isolate_scope(isolate_);
+  v8::HandleScope handle_scope(isolate_);
+
+  v8::TryCatch try_catch(isolate_);
+
+  v8::Local<v8::String> key;
+  if (!new_string(name).ToLocal(&key)) {
+    return false;
+  }
+
+  host_functions_[name] = function;
+
+  // the contexts created afterwards get the function from their global template
+  v8::Local<v8::FunctionTemplate> function_template = new_host_function(function);
+  for (auto& entry : contexts_) {
+    v8::Local<v8::Context> context = v8::Local<v8::Context>::New(isolate_, entry.second);
+    v8::Context::Scope context_scope(context);
+
+    v8::Local<v8::Function> host_function;
+    if (!function_template->GetFunction(context).ToLocal(&host_function) ||
+        context->Global()->Set(context, key, host_function).IsNothing()) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static bool read_file(const std::string& path, std::string* data) {
+  FILE* fp = fopen(path.c_str(), "rb");
+  if (!fp) {
+    return false;
+  }
+
+  char buf[8192];
+  size_t n;
+  data->clear();
+  while ((n = fread(buf, 1, sizeof(buf), fp)) > 0) {
+    data->append(buf, n);
+  }
+
+  bool ok = !ferror(fp);
+  fclose(fp);
+  return ok;
+}
+
+// writes 'data' to a temporary file first so that concurrent readers never see a partial file
+static bool write_file(const std::string& path, const std::string& data) {
+  // the temporary file is unique even among the threads of a process
+  std::string tmp = path + ".XXXXXX";
+  int fd = mkstemp(&tmp[0]);
+  if (fd < 0) {
+    return false;
+  }
+
+  FILE* fp = fdopen(fd, "wb");
+  if (!fp) {
+    close(fd);
+    remove(tmp.c_str());
+    return false;
+  }
+
+  bool ok = fwrite(data.data(), 1, data.size(), fp) == data.size();
+  ok = fclose(fp) == 0 && ok;
+  if (ok) {
+    ok = rename(tmp.c_str(), path.c_str()) == 0;
+  }
+  if (!ok) {
+    remove(tmp.c_str());
+  }
+  return ok;
+}
+
+void _V8::add_module(const std::string& name, const std::string& src) {
+  modules_[name] = src;
+
+  ModuleMap::iterator it = compiled_modules_.find(name);
+  if (it != compiled_modules_.end()) {
+    v8::Locker locker(isolate_);
+
+    v8::Isolate::Scope isolate_scope(isolate_);
+    it->second.Reset();
+    compiled_modules_.erase(it);
+  }
+
+  enable_modules();
+}
+
+void _V8::set_module_dir(const std::string& dir) {
+  module_dir_ = dir;
+  enable_modules();
+}
+
+void _V8::enable_modules() {
+  if (modules_enabled_) {
+    return;
+  }
+  modules_enabled_ = true;
+
+  v8::Locker locker(isolate_);
+
+  v8::Isolate::Scope isolate_scope(isolate_);
+  v8::HandleScope handle_scope(isolate_);
+
+  for (auto& entry : contexts_) {
+    install_require(v8::Local<v8::Context>::New(isolate_, entry.second));
+  }
+}
+
+void _V8::install_require(v8::Local<v8::Context> context) {
+  v8::Context::Scope context_scope(context);
+
+  // loaded modules by name, without a prototype so that any name can be looked up
+  v8::Local<v8::Object> modules = v8::Object::New(isolate_);
+  modules->SetPrototype(context, v8::Null(isolate_)).FromJust();
+  context->SetEmbedderData(kModulesIndex, modules);
+
+  v8::Local<v8::Function> require_function = v8::FunctionTemplate::New(isolate_, require)->GetFunction(context).ToLocalChecked();
+  context->Global()->Set(context, new_string("require"), require_function).FromJust();
+}
+
+bool _V8::load_module(const std::string& name, std::string* src) {
+  auto it = modules_.find(name);
+  if (it != modules_.end()) {
+    *src = it->second;
+    return true;
+  } else if (module_dir_.empty() || name.find("..") != std::string::npos) {
+    return false;
+  }
+
+  std::string path = module_dir_ + "/" + name;
+  return read_file(path, src) || read_file(path + ".js", src);
+}
+
+// modules are kept apart from the script cache, which may evict them or be disabled
+v8::MaybeLocal<v8::UnboundScript> _V8::compile_module(const std::string& name) {
+  ModuleMap::iterator it = compiled_modules_.find(name);
+  if (it != compiled_modules_.end()) {
+    return v8::Local<v8::UnboundScript>::New(isolate_, it->second);
+  }
+
+  std::string src;
+  if (!load_module(name, &src)) {
+    isolate_->ThrowException(v8::Exception::Error(new_string("Cannot find module '" + name + "'").ToLocalChecked()));
+    return v8::MaybeLocal<v8::UnboundScript>();  // empty
+  }
+
+  std::string wrapper = "(function (exports, require, module) {" + src + "\n})";
+  v8::Local<v8::UnboundScript> unbound;
+  if (!compile_unbound(wrapper, code_cache_dir_.empty() ? 0 : hash_source(wrapper), nullptr).ToLocal(&unbound)) {
+    return v8::MaybeLocal<v8::UnboundScript>();  // empty
+  }
+
+  compiled_modules_[name].Reset(isolate_, unbound);
+  return unbound;
+}
+
+void _V8::require(const v8::FunctionCallbackInfo<v8::Value>& info) {
+  v8::Isolate* isolate = info.GetIsolate();
+  _V8* v8 = static_cast<_V8*>(isolate->GetData(0));
+  v8::Local<v8::Context> context = isolate->GetCurrentContext();
+  v8::Local<v8::Object> modules = v8::Local<v8::Object>::Cast(context->GetEmbedderData(kModulesIndex));
+  v8::Local<v8::String> exports_key = v8->new_string("exports");
+
+  v8::Local<v8::String> name;
+  v8::Local<v8::Value> module;
+  if (!info[0]->ToString(context).ToLocal(&name) || !modules->Get(context, name).ToLocal(&module)) {
+    return;
+  }
+
+  v8::Local<v8::Value> exports;
+  if (module->IsObject()) {
+    // already loaded, or still loading if the modules require each other
+    if (v8::Local<v8::Object>::Cast(module)->Get(context, exports_key).ToLocal(&exports)) {
+      info.GetReturnValue().Set(exports);
+    }
+    return;
+  }
+
+  // compiled only once for all the contexts
+  v8::Local<v8::UnboundScript> unbound;
+  v8::Local<v8::Value> wrapper;
+  if (!v8->compile_module(to_std_string(name)).ToLocal(&unbound) ||
+      !unbound->BindToCurrentContext()->Run(context).ToLocal(&wrapper)) {
+    return;
+  }
+
+  v8::Local<v8::Object> new_module = v8::Object::New(isolate);
+  exports = v8::Object::New(isolate);
+  if (new_module->Set(context, exports_key, exports).IsNothing() || modules->Set(context, name, new_module).IsNothing()) {
+    return;
+  }
+
+  v8::Local<v8::Value> argv[] = {exports, info.Callee(), new_module};
+  if (v8::Local<v8::Function>::Cast(wrapper)->Call(context, exports, 3, argv).IsEmpty()) {
+    // let a later require load the module again (deleting fails only when the execution is being terminated)
+    modules->Delete(context, name).FromMaybe(false);
+    return;
+  }
+
+  if (new_module->Get(context, exports_key).ToLocal(&exports)) {
+    info.GetReturnValue().Set(exports);
+  }
+}
+
+v8::MaybeLocal<v8::Script> _V8::compile(const std::string& src, const std::shared_ptr<const Source>& external) {
+  uint64_t hash = 0;
+  if (external) {
+    hash = external->hash();
+  } else if (script_cache_->enabled() || !code_cache_dir_.empty()) {
+    hash = hash_source(src);
+  }
+
+  v8::Local<v8::UnboundScript> unbound;
+  if (script_cache_->enabled()) {
+    unbound = script_cache_->get(isolate_, hash, src);
+  }
+
+  if (unbound.IsEmpty()) {
+    if (!compile_unbound(src, hash, external).ToLocal(&unbound)) {
+      return v8::MaybeLocal<v8::Script>();  // empty
+    }
+
+    if (script_cache_->enabled()) {
+      script_cache_->put(isolate_, hash, external ? external->shared_str() : std::make_shared<const std::string>(src), unbound);
+    }
+  }
+
+  return unbound->BindToCurrentContext();
+}
+
+v8::MaybeLocal<v8::UnboundScript> _V8::compile_unbound(const std::string& src, uint64_t hash,
+                                                       const std::shared_ptr<const Source>& external) {
+  if (code_cache_dir_.empty()) {
+    return compile_unbound(src, v8::ScriptCompiler::kNoCompileOptions, nullptr, external);
+  }
+
+  char name[32];
+  snprintf(name, sizeof(name), "/%016llx.v8cache", static_cast<unsigned long long>(hash));
+  std::string path = code_cache_dir_ + name;
+
+  std::string cache;
+  v8::Local<v8::UnboundScript> unbound;
+  if (read_file(path, &cache)) {
+    if (!compile_unbound(src, v8::ScriptCompiler::kConsumeCodeCache, &cache, external).ToLocal(&unbound)) {
+      return v8::MaybeLocal<v8::UnboundScript>();  // empty
+    } else if (!cache.empty()) {
+      return unbound;
+    }
+
+    // rejected, e.g. after a V8 upgrade or a flag change: replace it so that later processes do not reject it again
+    if (!produce_isolated_code_cache(src, &cache) || !write_file(path, cache)) {
+      remove(path.c_str());
+    }
+    return unbound;
+  }
+
+  // no code cache: produce one for the next process
+  if (!compile_unbound(src, v8::ScriptCompiler::kProduceCodeCache, &cache, external).ToLocal(&unbound)) {
+    return v8::MaybeLocal<v8::UnboundScript>();  // empty
+  }
+
+  if (!cache.empty() || produce_isolated_code_cache(src, &cache)) {
+    write_file(path, cache);
+  }
+  return unbound;
+}
+
+// V8 produces no code cache when it takes the script from the isolate's compilation cache,
+// e.g. after the same source was compiled in this isolate, so the script is compiled again in a fresh isolate.
+bool _V8::produce_isolated_code_cache(const std::string& src, std::string* cache) {
+  cache->clear();
+  if (src.size() > static_cast<size_t>(v8::String::kMaxLength)) {
+    return false;
+  }
+
+  v8::Isolate::CreateParams create_params;
+  create_params.array_buffer_allocator = allocator_;
+  if (snapshot_) {
+    create_params.snapshot_blob = &startup_data_;
+  }
+  v8::Isolate* isolate = v8::Isolate::New(create_params);
+
+  {
+    v8::Locker locker(isolate);
+
+    v8::Isolate::Scope isolate_scope(isolate);
+    v8::HandleScope handle_scope(isolate);
+
+    v8::Local<v8::Context> context = v8::Context::New(isolate);
+    v8::Context::Scope context_scope(context);
+
+    v8::TryCatch try_catch(isolate);
+
+    v8::Local<v8::String> source_string;
+    v8::Local<v8::String> name;
+    if (v8::String::NewFromUtf8(isolate, src.data(), v8::NewStringType::kNormal, static_cast<int>(src.size()))
+            .ToLocal(&source_string) &&
+        v8::String::NewFromUtf8(isolate, "v8eval", v8::NewStringType::kNormal).ToLocal(&name)) {
+      v8::ScriptOrigin origin(name);
+      v8::ScriptCompiler::Source source(source_string, origin);
+
+      v8::Local<v8::UnboundScript> unbound;
+      if (v8::ScriptCompiler::CompileUnboundScript(isolate, &source, v8::ScriptCompiler::kProduceCodeCache)
+              .ToLocal(&unbound)) {
+        const v8::ScriptCompiler::CachedData* data = source.GetCachedData();
+        if (data) {
+          cache->assign(reinterpret_cast<const char*>(data->data), data->length);
+        }
+      }
+    }
+  }
+
+  isolate->Dispose();
+  return !cache->empty();
+}
+
+// kConsumeCodeCache consumes 'cache' and clears it if V8 rejects it.
+// kProduceCodeCache stores the produced code cache into 'cache'.
+v8::MaybeLocal<v8::UnboundScript> _V8::compile_unbound(const std::string& src,
+                                                       v8::ScriptCompiler::CompileOptions options,
+                                                       std::string* cache,
+                                                       const std::shared_ptr<const Source>& external) {
+  v8::ScriptCompiler::CachedData* cached_data = nullptr;
+  if (options == v8::ScriptCompiler::kConsumeCodeCache) {
+    if (cache->size() > INT_MAX) {
+      cache->clear();
+      options = v8::ScriptCompiler::kNoCompileOptions;
+    } else {
+      cached_data = new v8::ScriptCompiler::CachedData(reinterpret_cast<const uint8_t*>(cache->data()),
+                                                       static_cast<int>(cache->size()));
+    }
+  }
+
+  v8::Local<v8::String> source_string;
+  if (!(external ? new_external_string(external) : new_string(src)).ToLocal(&source_string)) {
+    delete cached_data;
+    return v8::MaybeLocal<v8::UnboundScript>();  // empty
+  }
+
+  v8::Local<v8::String> name = new_string("v8eval");
+  v8::ScriptOrigin origin(name);
+  v8::ScriptCompiler::Source source(source_string, origin, cached_data);  // takes ownership of cached_data
+
+  v8::Local<v8::UnboundScript> unbound;
+  if (!v8::ScriptCompiler::CompileUnboundScript(isolate_, &source, options).ToLocal(&unbound)) {
+    return v8::MaybeLocal<v8::UnboundScript>();  // empty
+  }
+
+  const v8::ScriptCompiler::CachedData* data = source.GetCachedData();
+  if (options == v8::ScriptCompiler::kConsumeCodeCache) {
+    if (data->rejected) {
+      cache->clear();
+    }
+  } else if (options == v8::ScriptCompiler::kProduceCodeCache) {
+    if (data) {
+      cache->assign(reinterpret_cast<const char*>(data->data), data->length);
+    } else {
+      cache->clear();
+    }
+  }
+
+  return unbound;
+}
+
+std::string _V8::eval(const std::string& src) {
+  return eval(src, nullptr);
+}
+
+std::string _V8::eval(const std::shared_ptr<const Source>& src) {
+  return eval(src->str(), src);
+}
+
+bool _V8::try_eval(const std::string& src, std::string* result) {
+  bool failed = false;
+  *result = eval(src, nullptr, &failed);
+  return !failed;
+}
+
+std::string _V8::eval(const std::string& src, const std::shared_ptr<const Source>& external, bool* failed) {
+  StatsScope stats(this, failed);
+  v8::Locker locker(isolate_);
+  stats.locked();
+  stats.add_bytes(src.size(), 0);
+
+  v8::Isolate::Scope isolate_scope(isolate_);
+  v8::HandleScope handle_scope(isolate_);
+
+  v8::Local<v8::Context> context = current_context();
+  v8::Context::Scope context_scope(context);
+
+  v8::TryCatch try_catch(isolate_);
+  ExecutionScope execution(isolate_, timeout_ms_, &heap_limit_reached_, &stats);
+
+  stats.start();
+  v8::Local<v8::Script> script;
+  bool compiled = compile(src, external).ToLocal(&script);
+  stats.stop(&_Stats::compile_ns);
+  if (!compiled) {
+    return execution.exception_message(try_catch);
+  }
+
+  return run_script(context, script, try_catch, execution);
+}
+
+std::string _V8::run_script(v8::Local<v8::Context> context, v8::Local<v8::Script> script,
+                            const v8::TryCatch& try_catch, const ExecutionScope& execution) {
+  StatsScope* stats = execution.stats();
+  stats->start();
+  v8::Local<v8::Value> result;
+  bool ran = script->Run(context).ToLocal(&result) && (!await_promises_ || settle_promise(context, &result));
+  stats->stop(&_Stats::run_ns);
+  if (!ran) {
+    return execution.exception_message(try_catch);
+  }
+
+  stats->start();
+  std::string json = to_std_string(json_stringify(context, result));
+  stats->stop(&_Stats::json_stringify_ns);
+  stats->add_bytes(0, json.size());
+  return try_catch.HasTerminated() ? execution.exception_message(try_catch) : json;
+}
+
+_SourceReader::~_SourceReader() {}
+
+// Passes the chunks read in the calling thread to V8's parser running in a background thread.
+class ChunkStream : public v8::ScriptCompiler::ExternalSourceStream {
+ public:
+  ChunkStream() : closed_(false) {}
+
+  virtual ~ChunkStream() {
+    for (auto& chunk : chunks_) {
+      delete[] chunk.first;
+    }
+  }
+
+  // called by the parser, which takes ownership of the data
+  virtual size_t GetMoreData(const uint8_t** src) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    pushed_.wait(lock, [this] { return closed_ || !chunks_.empty(); });
+    if (chunks_.empty()) {
+      return 0;
+    }
+
+    *src = chunks_.front().first;
+    size_t length = chunks_.front().second;
+    chunks_.pop_front();
+    return length;
+  }
+
+  void push(const std::string& chunk) {
+    uint8_t* data = new uint8_t[chunk.size()];
+    memcpy(data, chunk.data(), chunk.size());
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      chunks_.push_back(std::make_pair(data, chunk.size()));
+    }
+    pushed_.notify_one();
+  }
+
+  void close() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      closed_ = true;
+    }
+    pushed_.notify_one();
+  }
+
+ private:
+  std::mutex mutex_;
+  std::condition_variable pushed_;
+  std::deque<std::pair<uint8_t*, size_t>> chunks_;
+  bool closed_;
+};
+
+std::string _V8::eval_stream(_SourceReader* reader) {
+  StatsScope stats(this);
+  v8::Locker locker(isolate_);
+  stats.locked();
+
+  v8::Isolate::Scope isolate_scope(isolate_);
+  v8::HandleScope handle_scope(isolate_);
+
+  v8::Local<v8::Context> context = current_context();
+  v8::Context::Scope context_scope(context);
+
+  v8::TryCatch try_catch(isolate_);
+
+  // parse in the background while reading, as streamed scripts are not kept in the script cache
+  stats.start();
+  ChunkStream* stream = new ChunkStream();
+  v8::ScriptCompiler::StreamedSource source(stream, v8::ScriptCompiler::StreamedSource::UTF8);  // takes ownership of stream
+  std::unique_ptr<v8::ScriptCompiler::ScriptStreamingTask> task(v8::ScriptCompiler::StartStreamingScript(isolate_, &source));
+  std::thread parser([&task]() { task->Run(); });
+
+  // V8 still needs the whole source code after parsing it
+  std::string src;
+  _SourceChunk chunk;
+  bool read;
+  while ((read = reader->read(&chunk)) && !chunk.data.empty()) {
+    stream->push(chunk.data);
+    src += chunk.data;
+  }
+  stats.add_bytes(src.size(), 0);
+  stream->close();
+  parser.join();
+
+  if (!read) {
+    stats.fail();
+    stats.commit();
+    return "Error: " + chunk.data;
+  }
+
+  // armed only now, so that reading slowly does not time out
+  ExecutionScope execution(isolate_, timeout_ms_, &heap_limit_reached_, &stats);
+
+  v8::Local<v8::String> source_string;
+  v8::Local<v8::Script> script;
+  bool compiled = new_string(src).ToLocal(&source_string) &&
+                  v8::ScriptCompiler::Compile(context, &source, source_string, v8::ScriptOrigin(new_string("v8eval")))
+                      .ToLocal(&script);
+  stats.stop(&_Stats::compile_ns);
+  if (!compiled) {
+    return execution.exception_message(try_catch);
+  }
+
+  return run_script(context, script, try_catch, execution);
+}
+
+// Reads a file in chunks for eval_file()
+class FileReader : public _SourceReader {
+ public:
+  explicit FileReader(FILE* fp) : fp_(fp) {}
+
+  virtual bool read(_SourceChunk* chunk) {
+    char buffer[kChunkSize];
+    size_t length = fread(buffer, 1, sizeof(buffer), fp_);
+    if (length == 0 && ferror(fp_)) {
+      chunk->data = strerror(errno);
+      return false;
+    }
+
+    chunk->data.assign(buffer, length);
+    return true;
+  }
+
+ private:
+  static const size_t kChunkSize = 64 * 1024;
+
+  FILE* fp_;
+};
+
+std::string _V8::eval_file(const std::string& path) {
+  FILE* fp = fopen(path.c_str(), "rb");
+  if (!fp) {
+    return "Error: Cannot open file '" + path + "'";
+  }
+
+  FileReader reader(fp);
+  std::string result = eval_stream(&reader);
+  fclose(fp);
+  return result;
+}
+
+std::string _V8::call(const std::string& func, const std::string& args) {
+  StatsScope stats(this);
+  v8::Locker locker(isolate_);
+  stats.locked();
+  stats.add_bytes(args.size(), 0);
+
+  v8::Isolate::Scope isolate_scope(isolate_);
+  v8::HandleScope handle_scope(isolate_);
+
+  v8::Local<v8::Context> context = current_context();
+  v8::Context::Scope context_scope(context);
+
+  v8::TryCatch try_catch(isolate_);
+  ExecutionScope execution(isolate_, timeout_ms_, &heap_limit_reached_, &stats);
+
+  v8::Local<v8::Function> function;
+  if (!get_function(context, func).ToLocal(&function)) {
+    return execution.exception_message(try_catch);
+  }
+
+  return call_function(context, function, args, try_catch, execution);
+}
+
+std::string _V8::call_function(v8::Local<v8::Context> context, v8::Local<v8::Function> function, const std::string& args,
+                               const v8::TryCatch& try_catch, const ExecutionScope& execution) {
+  StatsScope* stats = execution.stats();
+  stats->start();
+  v8::Local<v8::String> args_string;
+  if (!new_string(args).ToLocal(&args_string)) {
+    return execution.exception_message(try_catch);
+  }
+
+  v8::Local<v8::Value> arguments = json_parse(context, args_string);
+  stats->stop(&_Stats::json_parse_ns);
+  if (try_catch.HasTerminated()) {
+    return execution.exception_message(try_catch);
+  } else if (arguments.IsEmpty() || !arguments->IsArray()) {
+    return execution.error("TypeError: '" + args + "' is not an array");
+  }
+
+  v8::Local<v8::Array> array = v8::Local<v8::Array>::Cast(arguments);
+  std::vector<v8::Local<v8::Value>> argv(array->Length());
+  for (uint32_t i = 0; i < array->Length(); i++) {
+    argv[i] = array->Get(context, i).ToLocalChecked();
+  }
+
+  // the function is its own receiver as it used to be with Function.prototype.apply
+  stats->start();
+  v8::Local<v8::Value> result;
+  bool ran = function->Call(context, function, static_cast<int>(argv.size()), argv.data()).ToLocal(&result) &&
+             (!await_promises_ || settle_promise(context, &result));
+  stats->stop(&_Stats::run_ns);
+  if (!ran) {
+    return execution.exception_message(try_catch);
+  }
+
+  stats->start();
+  std::string json = to_std_string(json_stringify(context, result));
+  stats->stop(&_Stats::json_stringify_ns);
+  stats->add_bytes(0, json.size());
+  return try_catch.HasTerminated() ? execution.exception_message(try_catch) : json;
+}
+
+std::string _V8::call_batch(const std::string& func, const std::string& args) {
+  StatsScope stats(this);
+  v8::Locker locker(isolate_);
+  stats.locked();
+  stats.add_bytes(args.size(), 0);
+
+  v8::Isolate::Scope isolate_scope(isolate_);
+  v8::HandleScope handle_scope(isolate_);
+
+  v8::Local<v8::Context> context = current_context();
+  v8::Context::Scope context_scope(context);
+
+  v8::TryCatch try_catch(isolate_);
+  ExecutionScope execution(isolate_, timeout_ms_, &heap_limit_reached_, &stats);
+
+  v8::Local<v8::Function> function;
+  if (!get_function(context, func).ToLocal(&function)) {
+    return execution.exception_message(try_catch);
+  }
+
+  stats.start();
+  v8::Local<v8::String> args_string;
+  if (!new_string(args).ToLocal(&args_string)) {
+    return execution.exception_message(try_catch);
+  }
+
+  v8::Local<v8::Value> arguments = json_parse(context, args_string);
+  stats.stop(&_Stats::json_parse_ns);
+  if (try_catch.HasTerminated()) {
+    return execution.exception_message(try_catch);
+  } else if (arguments.IsEmpty() || !arguments->IsArray()) {
+    return execution.error("TypeError: '" + args + "' is not an array");
+  }
+
+  stats.start();
+  v8::Local<v8::Array> rows = v8::Local<v8::Array>::Cast(arguments);
+  v8::Local<v8::Array> results = v8::Array::New(isolate_, static_cast<int>(rows->Length()));
+  std::vector<v8::Local<v8::Value>> argv;
+  for (uint32_t i = 0; i < rows->Length(); i++) {
+    v8::HandleScope call_scope(isolate_);
+
+    v8::Local<v8::Value> row = rows->Get(context, i).ToLocalChecked();
+    if (!row->IsArray()) {
+      return execution.error("TypeError: '" + to_std_string(json_stringify(context, row)) + "' is not an array");
+    }
+
+    v8::Local<v8::Array> row_array = v8::Local<v8::Array>::Cast(row);
+    argv.resize(row_array->Length());
+    for (uint32_t j = 0; j < row_array->Length(); j++) {
+      argv[j] = row_array->Get(context, j).ToLocalChecked();
+    }
+
+    v8::Local<v8::Value> result;
+    if (!function->Call(context, function, static_cast<int>(argv.size()), argv.data()).ToLocal(&result) ||
+        (await_promises_ && !settle_promise(context, &result)) || results->Set(context, i, result).IsNothing()) {
+      return execution.exception_message(try_catch);
+    }
+  }
+  stats.stop(&_Stats::run_ns);
+
+  stats.start();
+  std::string json = to_std_string(json_stringify(context, results));
+  stats.stop(&_Stats::json_stringify_ns);
+  stats.add_bytes(0, json.size());
+  return try_catch.HasTerminated() ? execution.exception_message(try_catch) : json;
+}
+
+std::string _V8::warmup(const std::string& func, const std::string& args, int iterations) {
+  StatsScope stats(this);
+  v8::Locker locker(isolate_);
+  stats.locked();
+  stats.add_bytes(args.size(), 0);
+
+  v8::Isolate::Scope isolate_scope(isolate_);
+  v8::HandleScope handle_scope(isolate_);
+
+  v8::Local<v8::Context> context = current_context();
+  v8::Context::Scope context_scope(context);
+
+  v8::TryCatch try_catch(isolate_);
+  ExecutionScope execution(isolate_, timeout_ms_, &heap_limit_reached_, &stats);
+
+  v8::Local<v8::Function> function;
+  if (!get_function(context, func).ToLocal(&function)) {
+    return execution.exception_message(try_catch);
+  }
+
+  stats.start();
+  v8::Local<v8::String> args_string;
+  if (!new_string(args).ToLocal(&args_string)) {
+    return execution.exception_message(try_catch);
+  }
+
+  v8::Local<v8::Value> arguments = json_parse(context, args_string);
+  stats.stop(&_Stats::json_parse_ns);
+  if (try_catch.HasTerminated()) {
+    return execution.exception_message(try_catch);
+  } else if (arguments.IsEmpty() || !arguments->IsArray()) {
+    return execution.error("TypeError: '" + args + "' is not an array");
+  }
+
+  // decode every sample once so that the calls only run the function
+  v8::Local<v8::Array> rows = v8::Local<v8::Array>::Cast(arguments);
+  std::vector<std::vector<v8::Local<v8::Value>>> samples(rows->Length());
+  for (uint32_t i = 0; i < rows->Length(); i++) {
+    v8::Local<v8::Value> row = rows->Get(context, i).ToLocalChecked();
+    if (!row->IsArray()) {
+      return execution.error("TypeError: '" + to_std_string(json_stringify(context, row)) + "' is not an array");
+    }
+
+    v8::Local<v8::Array> row_array = v8::Local<v8::Array>::Cast(row);
+    samples[i].resize(row_array->Length());
+    for (uint32_t j = 0; j < row_array->Length(); j++) {
+      samples[i][j] = row_array->Get(context, j).ToLocalChecked();
+    }
+  }
+
+  stats.start();
+  for (int n = 0; n < iterations; n++) {
+    for (auto& argv : samples) {
+      v8::HandleScope call_scope(isolate_);
+
+      v8::Local<v8::Value> result;
+      if (!function->Call(context, function, static_cast<int>(argv.size()), argv.data()).ToLocal(&result) ||
+          (await_promises_ && !settle_promise(context, &result))) {
+        return execution.exception_message(try_catch);
+      }
+    }
+  }
+  stats.stop(&_Stats::run_ns);
+  return try_catch.HasTerminated() ? execution.exception_message(try_catch) : "";
+}
+
+static bool set_error(std::string* error, const std::string& message) {
+  if (error) {
+    *error = message;
+  }
+  return false;
+}
+
+bool _V8::call(const std::string& func, const Value::Array& args, Value* result, std::string* error) {
+  StatsScope stats(this);
+  v8::Locker locker(isolate_);
+  stats.locked();
+
+  v8::Isolate::Scope isolate_scope(isolate_);
+  v8::HandleScope handle_scope(isolate_);
+
+  v8::Local<v8::Context> context = current_context();
+  v8::Context::Scope context_scope(context);
+
+  v8::TryCatch try_catch(isolate_);
+  ExecutionScope execution(isolate_, timeout_ms_, &heap_limit_reached_, &stats);
+
+  v8::Local<v8::Function> function;
+  if (!get_function(context, func).ToLocal(&function)) {
+    return set_error(error, execution.exception_message(try_catch));
+  }
+
+  return call_function(context, function, args, result, error, try_catch, execution);
+}
+
+bool _V8::call_function(v8::Local<v8::Context> context, v8::Local<v8::Function> function, const Value::Array& args,
+                        Value* result, std::string* error, const v8::TryCatch& try_catch, const ExecutionScope& execution) {
+  StatsScope* stats = execution.stats();
+  stats->start();
+  std::vector<v8::Local<v8::Value>> argv(args.size());
+  for (size_t i = 0; i < args.size(); i++) {
+    if (!to_v8(context, args[i], &argv[i])) {
+      return set_error(error, execution.exception_message(try_catch));
+    }
+  }
+  stats->stop(&_Stats::json_parse_ns);
+
+  // the function is its own receiver as in call() with JSON
+  stats->start();
+  v8::Local<v8::Value> value;
+  bool ran = function->Call(context, function, static_cast<int>(argv.size()), argv.data()).ToLocal(&value) &&
+             (!await_promises_ || settle_promise(context, &value));
+  stats->stop(&_Stats::run_ns);
+  if (!ran) {
+    return set_error(error, execution.exception_message(try_catch));
+  }
+
+  stats->start();
+  bool converted = from_v8(context, value, result);
+  stats->stop(&_Stats::json_stringify_ns);
+  if (!converted) {
+    return set_error(error, execution.exception_message(try_catch));
+  }
+
+  return true;
+}
+
+bool _V8::call_batch(const std::string& func, const std::vector<Value::Array>& args, Value::Array* results, std::string* error) {
+  StatsScope stats(this);
+  v8::Locker locker(isolate_);
+  stats.locked();
+
+  v8::Isolate::Scope isolate_scope(isolate_);
+  v8::HandleScope handle_scope(isolate_);
+
+  v8::Local<v8::Context> context = current_context();
+  v8::Context::Scope context_scope(context);
+
+  v8::TryCatch try_catch(isolate_);
+  ExecutionScope execution(isolate_, timeout_ms_, &heap_limit_reached_, &stats);
+
+  v8::Local<v8::Function> function;
+  if (!get_function(context, func).ToLocal(&function)) {
+    return set_error(error, execution.exception_message(try_catch));
+  }
+
+  // the conversions of the rows are counted as run time
+  stats.start();
+  results->assign(args.size(), Value());
+  std::vector<v8::Local<v8::Value>> argv;
+  for (size_t i = 0; i < args.size(); i++) {
+    v8::HandleScope call_scope(isolate_);
+
+    argv.resize(args[i].size());
+    for (size_t j = 0; j < args[i].size(); j++) {
+      if (!to_v8(context, args[i][j], &argv[j])) {
+        return set_error(error, execution.exception_message(try_catch));
+      }
+    }
+
+    v8::Local<v8::Value> value;
+    if (!function->Call(context, function, static_cast<int>(argv.size()), argv.data()).ToLocal(&value) ||
+        (await_promises_ && !settle_promise(context, &value)) || !from_v8(context, value, &(*results)[i])) {
+      return set_error(error, execution.exception_message(try_catch));
+    }
+  }
+  stats.stop(&_Stats::run_ns);
+
+  return true;
+}
+
+static const int kMaxValueDepth = 128;
+
+bool _V8::to_v8(v8::Local<v8::Context> context, const Value& value, v8::Local<v8::Value>* result) {
+  switch (value.type()) {
+    case Value::kUndefined:
+      *result = v8::Undefined(isolate_);
+      return true;
+    case Value::kNull:
+      *result = v8::Null(isolate_);
+      return true;
+    case Value::kBoolean:
+      *result = v8::Boolean::New(isolate_, value.boolean());
+      return true;
+    case Value::kNumber:
+      *result = v8::Number::New(isolate_, value.number());
+      return true;
+    case Value::kString: {
+      v8::Local<v8::String> v8_str;
+      if (!new_string(value.string()).ToLocal(&v8_str)) {
+        return false;
+      }
+      *result = v8_str;
+      return true;
+    }
+    case Value::kArray: {
+      const Value::Array& array = value.array();
+      v8::Local<v8::Array> v8_array = v8::Array::New(isolate_, static_cast<int>(array.size()));
+      for (size_t i = 0; i < array.size(); i++) {
+        v8::Local<v8::Value> element;
+        if (!to_v8(context, array[i], &element) || v8_array->Set(context, static_cast<uint32_t>(i), element).IsNothing()) {
+          return false;
+        }
+      }
+      *result = v8_array;
+      return true;
+    }
+    case Value::kObject: {
+      v8::Local<v8::Object> v8_object = v8::Object::New(isolate_);
+      for (Value::Object::const_iterator it = value.object().begin(); it != value.object().end(); ++it) {
+        v8::Local<v8::Value> key;
+        v8::Local<v8::Value> property;
+        if (!to_v8(context, Value(it->first), &key) || !to_v8(context, it->second, &property) ||
+            v8_object->Set(context, key, property).IsNothing()) {
+          return false;
+        }
+      }
+      *result = v8_object;
+      return true;
+    }
+  }
+  return false;
+}
+
+bool _V8::from_v8(v8::Local<v8::Context> context, v8::Local<v8::Value> value, Value* result, int depth) {
+  if (value->IsUndefined() || value->IsFunction() || value->IsSymbol()) {
+    *result = Value();
+  } else if (value->IsNull()) {
+    *result = Value::null();
+  } else if (value->IsBoolean()) {
+    *result = Value(value->IsTrue());
+  } else if (value->IsNumber()) {
+    *result = Value(value.As<v8::Number>()->Value());
+  } else if (value->IsString()) {
+    v8::String::Utf8Value str(value);
+    *result = Value(std::string(*str, str.length()));
+  } else if (depth >= kMaxValueDepth) {
+    isolate_->ThrowException(v8::Exception::RangeError(new_string("Maximum value nesting depth exceeded")));
+    return false;
+  } else if (value->IsArray()) {
+    v8::Local<v8::Array> array = value.As<v8::Array>();
+    *result = Value(Value::Array(array->Length()));
+    for (uint32_t i = 0; i < array->Length(); i++) {
+      v8::Local<v8::Value> element;
+      if (!array->Get(context, i).ToLocal(&element) || !from_v8(context, element, &result->array()[i], depth + 1)) {
+        return false;
+      }
+    }
+  } else {
+    v8::Local<v8::Object> object = value.As<v8::Object>();
+    v8::Local<v8::Array> keys;
+    if (!object->GetOwnPropertyNames(context).ToLocal(&keys)) {
+      return false;
+    }
+
+    *result = Value(Value::Object());
+    for (uint32_t i = 0; i < keys->Length(); i++) {
+      v8::Local<v8::Value> key;
+      v8::Local<v8::Value> property;
+      if (!keys->Get(context, i).ToLocal(&key) || !object->Get(context, key).ToLocal(&property) ||
+          !from_v8(context, property, &result->object()[to_std_string(key)], depth + 1)) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+// receives the outcome of a promise from its reaction handlers
+// The reactions stay attached to a promise which is still pending when settle_promise() returns,
+// and may run in a later eval, so the state lives until they are garbage collected.
+struct PromiseState {
+  PromiseState() : settled(false), rejected(false) {}
+
+  ~PromiseState() {
+    value.Reset();
+    data.Reset();
+  }
+
+  static void collect(const v8::WeakCallbackInfo<PromiseState>& info) {
+    delete info.GetParameter();
+  }
+
+  bool settled;
+  bool rejected;
+  v8::Persistent<v8::Value> value;
+  v8::Persistent<v8::External> data;  // weak, shared by the reactions
+};
+
+template <bool rejected>
+static void on_promise_settled(const v8::FunctionCallbackInfo<v8::Value>& info) {
+  PromiseState* state = static_cast<PromiseState*>(v8::Local<v8::External>::Cast(info.Data())->Value());
+  state->settled = true;
+  state->rejected = rejected;
+  state->value.Reset(info.GetIsolate(), info[0]);
+}
+
+bool _V8::settle_promise(v8::Local<v8::Context> context, v8::Local<v8::Value>* value) {
+  if (!(*value)->IsPromise()) {
+    isolate_->RunMicrotasks();
+    return true;
+  }
+
+  PromiseState* state = new PromiseState();
+  v8::Local<v8::External> data = v8::External::New(isolate_, state);
+  state->data.Reset(isolate_, data);
+  state->data.SetWeak(state, PromiseState::collect, v8::WeakCallbackType::kParameter);
+
+  v8::Local<v8::Promise> promise = v8::Local<v8::Promise>::Cast(*value);
+  v8::Local<v8::Function> on_fulfilled;
+  v8::Local<v8::Function> on_rejected;
+  if (!v8::Function::New(context, on_promise_settled<false>, data).ToLocal(&on_fulfilled) ||
+      !v8::Function::New(context, on_promise_settled<true>, data).ToLocal(&on_rejected) ||
+      promise->Then(context, on_fulfilled).IsEmpty() || promise->Catch(context, on_rejected).IsEmpty()) {
+    return false;
+  }
+
+  isolate_->RunMicrotasks();
+
+  if (!state->settled) {
+    // nothing is left to settle the promise, as there is no event loop
+    isolate_->ThrowException(v8::Exception::Error(new_string("Promise was not settled")));
+    return false;
+  } else if (state->rejected) {
+    isolate_->ThrowException(v8::Local<v8::Value>::New(isolate_, state->value));
+    return false;
+  }
+
+  *value = v8::Local<v8::Value>::New(isolate_, state->value);
+  return true;
+}
+
+bool _V8::set_buffer(const std::string& name, void* data, size_t length, std::string* error) {
+  v8::Locker locker(isolate_);
+
+  v8::Isolate::Scope isolate_scope(isolate_);
+  v8::HandleScope handle_scope(isolate_);
+
+  v8::Local<v8::Context> context = current_context();
+  v8::Context::Scope context_scope(context);
+
+  v8::TryCatch try_catch(isolate_);
+
+  release_buffer(name);
+
+  // the memory stays owned by the caller, so V8 never frees it
+  v8::Local<v8::ArrayBuffer> buffer = v8::ArrayBuffer::New(isolate_, data, length, v8::ArrayBuffer::kExternalized);
+  v8::Local<v8::String> key;
+  if (!new_string(name).ToLocal(&key) || context->Global()->Set(context, key, buffer).IsNothing()) {
+    buffer->Neuter();
+    return set_error(error, to_std_string(try_catch.Exception()));
+  }
+
+  buffers_[std::make_pair(context_name_, name)].Reset(isolate_, buffer);
+  return true;
+}
+
+bool _V8::get_buffer(const std::string& name, void** data, size_t* length, std::string* error) {
+  v8::Locker locker(isolate_);
+
+  v8::Isolate::Scope isolate_scope(isolate_);
+  v8::HandleScope handle_scope(isolate_);
+
+  v8::Local<v8::Context> context = current_context();
+  v8::Context::Scope context_scope(context);
+
+  v8::TryCatch try_catch(isolate_);
+
+  v8::Local<v8::String> key;
+  v8::Local<v8::Value> value;
+  if (!new_string(name).ToLocal(&key) || !context->Global()->Get(context, key).ToLocal(&value)) {
+    return set_error(error, to_std_string(try_catch.Exception()));
+  }
+
+  v8::Local<v8::ArrayBuffer> buffer;
+  size_t offset = 0;
+  if (value->IsArrayBuffer()) {
+    buffer = v8::Local<v8::ArrayBuffer>::Cast(value);
+    *length = buffer->ByteLength();
+  } else if (value->IsArrayBufferView()) {
+    v8::Local<v8::ArrayBufferView> view = v8::Local<v8::ArrayBufferView>::Cast(value);
+    buffer = view->Buffer();
+    offset = view->ByteOffset();
+    *length = view->ByteLength();
+  } else {
+    return set_error(error, "TypeError: '" + name + "' is not an ArrayBuffer or an ArrayBufferView");
+  }
+
+  // a buffer set under the same name but no longer held by the variable is released,
+  // or the caller's memory would stay reachable from JavaScript without being tracked
+  BufferMap::key_type buffer_key = std::make_pair(context_name_, name);
+  BufferMap::iterator it = buffers_.find(buffer_key);
+  if (it != buffers_.end() && v8::Local<v8::ArrayBuffer>::New(isolate_, it->second) != buffer) {
+    release_buffer(it);
+  }
+
+  // pin the buffer so that the memory stays valid even if JavaScript drops it
+  buffers_[buffer_key].Reset(isolate_, buffer);
+  *data = static_cast<char*>(buffer->GetContents().Data()) + offset;
+  return true;
+}
+
+bool _V8::release_buffer(const std::string& name) {
+  auto it = buffers_.find(std::make_pair(context_name_, name));
+  if (it == buffers_.end()) {
+    return false;
+  }
+
+  v8::Locker locker(isolate_);
+
+  v8::Isolate::Scope isolate_scope(isolate_);
+  v8::HandleScope handle_scope(isolate_);
+
+  release_buffer(it);
+  return true;
+}
+
+void _V8::release_buffer(BufferMap::iterator it) {
+  v8::Local<v8::ArrayBuffer> buffer = v8::Local<v8::ArrayBuffer>::New(isolate_, it->second);
+  if (buffer->IsExternal()) {
+    // the caller may free the memory from now on
+    buffer->Neuter();
+  }
+  it->second.Reset();
+  buffers_.erase(it);
+}
+
+void _V8::release_buffers(const std::string& context_name) {
+  auto it = buffers_.lower_bound(std::make_pair(context_name, std::string()));
+  while (it != buffers_.end() && it->first.first == context_name) {
+    release_buffer(it++);
+  }
+}
+
+void _V8::set_array_buffer_limit(size_t limit) {
+  allocator_->set_limit(limit);
+}
+
+size_t _V8::array_buffer_bytes() const {
+  return allocator_->bytes();
+}
+
+void _V8::set_stats_enabled(bool enabled) {
+  stats_enabled_ = enabled;
+}
+
+_Stats _V8::stats() const {
+  std::lock_guard<std::mutex> lock(stats_mutex_);
+  return stats_;
+}
+
+_Stats _V8::last_stats() const {
+  std::lock_guard<std::mutex> lock(stats_mutex_);
+  return last_stats_;
+}
+
+void _V8::reset_stats() {
+  std::lock_guard<std::mutex> lock(stats_mutex_);
+  stats_ = _Stats();
+  last_stats_ = _Stats();
+}
+
+void _V8::set_await_promises(bool await_promises) {
+  await_promises_ = await_promises;
+}
+
+v8::MaybeLocal<v8::Function> _V8::get_function(v8::Local<v8::Context> context, const std::string& func) {
+  v8::Local<v8::String> name;
+  v8::Local<v8::Value> value;
+  if (!new_string(func).ToLocal(&name) || !context->Global()->Get(context, name).ToLocal(&value)) {
+    return v8::MaybeLocal<v8::Function>();  // empty
+  } else if (!value->IsFunction()) {
+    isolate_->ThrowException(v8::Exception::TypeError(new_string("'" + func + "' is not a function").ToLocalChecked()));
+    return v8::MaybeLocal<v8::Function>();  // empty
+  }
+
+  return v8::Local<v8::Function>::Cast(value);
+}
+
+void _V8::set_timeout(int timeout_ms) {
+  timeout_ms_ = timeout_ms;
+}
+
+void _V8::set_script_cache_capacity(size_t capacity) {
+  v8::Locker locker(isolate_);
+
+  v8::Isolate::Scope isolate_scope(isolate_);
+  script_cache_->set_capacity(capacity);
+}
+
+std::string _V8::produce_code_cache(const std::string& src) {
+  v8::Locker locker(isolate_);
+
+  v8::Isolate::Scope isolate_scope(isolate_);
+  v8::HandleScope handle_scope(isolate_);
+
+  v8::Local<v8::Context> context = current_context();
+  v8::Context::Scope context_scope(context);
+
+  v8::TryCatch try_catch(isolate_);
+
+  std::string cache;
+  v8::Local<v8::UnboundScript> unbound;
+  if (!compile_unbound(src, v8::ScriptCompiler::kProduceCodeCache, &cache).ToLocal(&unbound)) {
+    return "";
+  } else if (cache.empty()) {
+    produce_isolated_code_cache(src, &cache);
+  }
+
+  if (script_cache_->enabled()) {
+    script_cache_->put(isolate_, hash_source(src), std::make_shared<const std::string>(src), unbound);
+  }
+  return cache;
+}
+
+bool _V8::consume_code_cache(const std::string& src, const std::string& data) {
+  v8::Locker locker(isolate_);
+
+  v8::Isolate::Scope isolate_scope(isolate_);
+  v8::HandleScope handle_scope(isolate_);
+
+  v8::Local<v8::Context> context = current_context();
+  v8::Context::Scope context_scope(context);
+
+  v8::TryCatch try_catch(isolate_);
+
+  std::string cache = data;
+  v8::Local<v8::UnboundScript> unbound;
+  if (!compile_unbound(src, v8::ScriptCompiler::kConsumeCodeCache, &cache).ToLocal(&unbound)) {
+    return false;
+  }
+
+  if (script_cache_->enabled()) {
+    script_cache_->put(isolate_, hash_source(src), std::make_shared<const std::string>(src), unbound);
+  }
+  return !cache.empty();
+}
+
+void _V8::set_code_cache_dir(const std::string& dir) {
+  code_cache_dir_ = dir;
+}
+
+size_t _V8::script_cache_hits() const {
+  return script_cache_->hits();
+}
+
+size_t _V8::script_cache_misses() const {
+  return script_cache_->misses();
+}
+
+_Function::_Function(_V8* v8, const std::string& func) : v8_(v8), func_(func) {
+  v8::Isolate* isolate = v8_->isolate_;
+  v8::Locker locker(isolate);
+
+  v8::Isolate::Scope isolate_scope(isolate);
+  v8::HandleScope handle_scope(isolate);
+
+  v8::Local<v8::Context> context = v8_->current_context();
+  v8::Context::Scope context_scope(context);
+
+  v8::TryCatch try_catch(isolate);
+
+  v8::Local<v8::Function> function;
+  if (v8_->get_function(context, func).ToLocal(&function)) {
+    function_.Reset(isolate, function);
+  }
+}
+
+_Function::~_Function() {
+  function_.Reset();
+}
+
+bool _Function::is_function() const {
+  return !function_.IsEmpty();
+}
+
+std::string _Function::call(const std::string& args) {
+  v8::Isolate* isolate = v8_->isolate_;
+  StatsScope stats(v8_);
+  v8::Locker locker(isolate);
+  stats.locked();
+  stats.add_bytes(args.size(), 0);
+
+  v8::Isolate::Scope isolate_scope(isolate);
+  v8::HandleScope handle_scope(isolate);
+
+  if (function_.IsEmpty()) {
+    stats.fail();
+    stats.commit();
+    return "TypeError: '" + func_ + "' is not a function";
+  }
+
+  v8::Local<v8::Function> function = v8::Local<v8::Function>::New(isolate, function_);
+  v8::Local<v8::Context> context = function->CreationContext();
+  v8::Context::Scope context_scope(context);
+
+  v8::TryCatch try_catch(isolate);
+  ExecutionScope execution(isolate, v8_->timeout_ms_, &v8_->heap_limit_reached_, &stats);
+
+  return v8_->call_function(context, function, args, try_catch, execution);
+}
+
+bool _Function::call(const Value::Array& args, Value* result, std::string* error) {
+  v8::Isolate* isolate = v8_->isolate_;
+  StatsScope stats(v8_);
+  v8::Locker locker(isolate);
+  stats.locked();
+
+  v8::Isolate::Scope isolate_scope(isolate);
+  v8::HandleScope handle_scope(isolate);
+
+  if (function_.IsEmpty()) {
+    stats.fail();
+    stats.commit();
+    return set_error(error, "TypeError: '" + func_ + "' is not a function");
+  }
+
+  v8::Local<v8::Function> function = v8::Local<v8::Function>::New(isolate, function_);
+  v8::Local<v8::Context> context = function->CreationContext();
+  v8::Context::Scope context_scope(context);
+
+  v8::TryCatch try_catch(isolate);
+  ExecutionScope execution(isolate, v8_->timeout_ms_, &v8_->heap_limit_reached_, &stats);
+
+  return v8_->call_function(context, function, args, result, error, try_catch, execution);
+}
+
+V8Pool::V8Pool(size_t size, const std::string& src) : instances_(size) {
+  std::vector<std::string> errors(size);
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < size; i++) {
+    threads.push_back(std::thread([this, i, &src, &errors]() {
+      _V8* v8 = new _V8();
+      std::string result;
+      if (!v8->try_eval(src, &result)) {
+        errors[i] = result;
+      }
+      instances_[i] = v8;
+    }));
+  }
+  for (size_t i = 0; i < size; i++) {
+    threads[i].join();
+    if (error_.empty()) {
+      error_ = errors[i];
+    }
+  }
+
+  available_ = instances_;
+}
+
+V8Pool::~V8Pool() {
+  for (size_t i = 0; i < instances_.size(); i++) {
+    delete instances_[i];
+  }
+}
+
+_V8* V8Pool::acquire() {
+  if (instances_.empty()) {
+    return nullptr;
+  }
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  released_.wait(lock, [this]() { return !available_.empty(); });
+
+  _V8* v8 = available_.back();
+  available_.pop_back();
+  return v8;
+}
+
+void V8Pool::release(_V8* v8) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    available_.push_back(v8);
+  }
+  released_.notify_one();
+}
+
+size_t V8Pool::size() const {
+  return instances_.size();
+}
+
+bool V8Pool::ok() const {
+  return error_.empty();
+}
+
+const std::string& V8Pool::error() const {
+  return error_;
+}
+
+V8Executor::V8Executor(size_t num_threads, const std::string& src, bool await_promises)
+    : src_(src), await_promises_(await_promises), stop_(false), num_bootstrapped_(0) {
+  for (size_t i = 0; i < num_threads; i++) {
+    threads_.push_back(std::thread(&V8Executor::run, this));
+  }
+}
+
+V8Executor::~V8Executor() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  submitted_.notify_all();
+
+  for (size_t i = 0; i < threads_.size(); i++) {
+    threads_[i].join();
+  }
+}
+
+// tasks run without an instance when there is no worker thread
+static const char kNoWorkerThreads[] = "Error: V8Executor has no worker threads";
+
+std::future<std::string> V8Executor::eval(const std::string& src) {
+  std::shared_ptr<std::promise<std::string>> promise = std::make_shared<std::promise<std::string>>();
+  submit([promise, src](_V8* v8) { promise->set_value(v8 ? v8->eval(src) : kNoWorkerThreads); });
+  return promise->get_future();
+}
+
+void V8Executor::eval(const std::string& src, const Callback& callback) {
+  submit([callback, src](_V8* v8) { callback(v8 ? v8->eval(src) : kNoWorkerThreads); });
+}
+
+std::future<std::string> V8Executor::call(const std::string& func, const std::string& args) {
+  std::shared_ptr<std::promise<std::string>> promise = std::make_shared<std::promise<std::string>>();
+  submit([promise, func, args](_V8* v8) { promise->set_value(v8 ? v8->call(func, args) : kNoWorkerThreads); });
+  return promise->get_future();
+}
+
+void V8Executor::call(const std::string& func, const std::string& args, const Callback& callback) {
+  submit([callback, func, args](_V8* v8) { callback(v8 ? v8->call(func, args) : kNoWorkerThreads); });
+}
+
+void V8Executor::submit(const Task& task) {
+  // without worker threads the request would never finish, so it is rejected right away
+  if (threads_.empty()) {
+    task(nullptr);
+    return;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    tasks_.push_back(task);
+  }
+  submitted_.notify_one();
+}
+
+bool V8Executor::ok() const {
+  return error().empty();
+}
+
+std::string V8Executor::error() const {
+  std::unique_lock<std::mutex> lock(mutex_);
+  bootstrapped_.wait(lock, [this]() { return num_bootstrapped_ == threads_.size(); });
+  return error_;
+}
+
+void V8Executor::run() {
+  _V8 v8;
+  v8.set_await_promises(await_promises_);
+  std::string result;
+  bool bootstrapped = v8.try_eval(src_, &result);
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!bootstrapped && error_.empty()) {
+      error_ = result;
+    }
+    num_bootstrapped_++;
+  }
+  bootstrapped_.notify_all();
+
+  for (;;) {
+    Task task;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      submitted_.wait(lock, [this]() { return stop_ || !tasks_.empty(); });
+      if (tasks_.empty()) {
+        return;
+      }
+
+      task = tasks_.front();
+      tasks_.pop_front();
+    }
+
+    task(&v8);
   }
 }
 
@@ -1,18 +1,58 @@
 #ifndef V8EVAL_H_
 #define V8EVAL_H_
 
+#include <stdint.h>
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <utility>
+#include <vector>
 
 #include "v8.h"
 
 /// \file
 namespace v8eval {
 
+class AccountingAllocator;
+class ExecutionScope;
+class ExternalTwoByteSource;
+class ScriptCache;
+class StatsScope;
+
+/// \brief Set V8 flags
+/// \param flags V8 command line flags separated by spaces (e.g. "--nolazy")
+///
+/// This method sets flags of the V8 runtime environment, which are shared by every V8 instance in the process.
+/// It should be called before initialize().
+/// For example, "--nolazy" compiles every function together with its script instead of on its first call,
+/// which moves the compile cost from the first calls to eval.
+void set_flags(const std::string& flags);
+
 /// \brief Initialize the V8 runtime environment
+/// \param thread_pool_size Number of V8's background worker threads (0 to choose it from the number of CPUs)
 /// \return success or not as boolean
 ///
 /// This method initializes the V8 runtime environment. It must be called before creating any V8 instance.
-bool initialize();
+/// The worker threads run background tasks such as concurrent GC and compilation;
+/// limiting them avoids oversubscribing hosts which run many processes.
+bool initialize(int thread_pool_size = 0);
+
+#ifndef SWIG
+/// \brief Initialize the V8 runtime environment with a custom platform
+/// \param platform Platform which runs V8's background tasks (e.g. on an existing thread pool)
+/// \return success or not as boolean
+///
+/// This method is the same as initialize() but uses the given platform instead of V8's default one.
+/// The platform is owned by the caller and must outlive dispose().
+bool initialize(v8::Platform* platform);
+#endif
 
 /// \brief Dispose the V8 runtime environment
 /// \return success or not as boolean
@@ -20,13 +60,231 @@ bool initialize();
 /// This method disposes the V8 runtime environment.
 bool dispose();
 
+/// \brief Create a startup snapshot
+/// \param src JavaScript code to run before the snapshot is taken
+/// \return snapshot data, or an empty string if 'src' fails
+///
+/// This method creates a V8 startup snapshot whose context already contains
+/// everything defined by the given JavaScript code 'src' (e.g. libraries and helper functions).
+/// The runtime environment must be initialized.
+std::string create_snapshot(const std::string& src);
+
+/// \brief Set the startup snapshot of new V8 instances
+/// \param data Snapshot data created by create_snapshot() ("" restores the default)
+///
+/// This method makes every _V8 instance created afterwards start from the given snapshot,
+/// so that its context comes up with the preloaded code without running it again.
+/// Existing instances are not affected.
+void set_snapshot(const std::string& data);
+
+#ifndef SWIG
+/// \brief Set the ArrayBuffer allocator of new V8 instances
+/// \param allocator ArrayBuffer allocator (nullptr restores the default)
+///
+/// This method makes every _V8 instance created afterwards allocate the backing stores of its ArrayBuffers
+/// with the given allocator, e.g. an ArrayBufferPool shared by all instances.
+/// The allocator must be thread-safe and outlive those instances.
+/// The default allocator gets zeroed memory from calloc.
+void set_array_buffer_allocator(v8::ArrayBuffer::Allocator* allocator);
+
+/// \class ArrayBufferPool
+///
+/// ArrayBufferPool is a thread-safe ArrayBuffer allocator which keeps freed backing stores for reuse.
+/// Sizes are rounded up to a power of two from 16 bytes to 1 MB, and each size class has its own free list.
+/// Larger ArrayBuffers are allocated and freed directly.
+class ArrayBufferPool : public v8::ArrayBuffer::Allocator {
+ public:
+  /// \brief Create a pool
+  /// \param max_cached_bytes Maximum total size of the freed backing stores kept for reuse
+  explicit ArrayBufferPool(size_t max_cached_bytes = 16 << 20);
+  virtual ~ArrayBufferPool();
+
+  virtual void* Allocate(size_t length);
+  virtual void* AllocateUninitialized(size_t length);
+  virtual void Free(void* data, size_t length);
+
+  /// \brief Get the total size of the backing stores kept for reuse
+  /// \return total size in bytes
+  size_t cached_bytes();
+
+ private:
+  static const int kNumSizeClasses = 17;
+
+  static int size_class(size_t length);
+  void* pop(int size_class);
+
+ private:
+  std::mutex mutex_;
+  std::vector<void*> free_lists_[kNumSizeClasses];
+  size_t cached_bytes_;
+  size_t max_cached_bytes_;
+};
+
+/// \class Value
+///
+/// Value instances represent JavaScript values passed to and from _V8 without JSON encoding.
+/// A value is undefined, null, a boolean, a number, a string, an array or an object.
+/// Objects are represented by their own enumerable properties.
+class Value {
+ public:
+  enum Type { kUndefined, kNull, kBoolean, kNumber, kString, kArray, kObject };
+
+  typedef std::vector<Value> Array;
+  typedef std::map<std::string, Value> Object;
+
+  Value();
+  Value(bool boolean);
+  Value(int number);
+  Value(double number);
+  Value(const char* str);
+  Value(const std::string& str);
+  Value(const Array& array);
+  Value(const Object& object);
+
+  /// \brief Create a null value
+  /// \return null value
+  static Value null();
+
+  Type type() const { return type_; }
+
+  bool boolean() const { return boolean_; }
+  double number() const { return number_; }
+  const std::string& string() const { return string_; }
+  const Array& array() const { return array_; }
+  Array& array() { return array_; }
+  const Object& object() const { return object_; }
+  Object& object() { return object_; }
+
+  bool operator==(const Value& other) const;
+  bool operator!=(const Value& other) const { return !(*this == other); }
+
+ private:
+  Type type_;
+  bool boolean_;
+  double number_;
+  std::string string_;
+  Array array_;
+  Object object_;
+};
+
+/// \class Source
+///
+/// Source instances hold JavaScript code that V8 reads in place through external strings
+/// instead of copying it into each isolate.
+/// A Source instance is immutable and can be shared by any number of _V8 instances in any threads.
+/// It stays alive as long as a _V8 instance refers to it.
+class Source {
+ public:
+  /// \brief Create a source
+  /// \param src JavaScript code (UTF-8)
+  ///
+  /// ASCII code is referenced as it is.
+  /// Other code is transcoded to UTF-16 once, when this instance is created.
+  explicit Source(const std::string& src);
+  explicit Source(std::string&& src);
+
+  const std::string& str() const { return *src_; }
+  const std::shared_ptr<const std::string>& shared_str() const { return src_; }
+  uint64_t hash() const { return hash_; }
+
+ private:
+  friend class _V8;
+  friend class ExternalTwoByteSource;
+
+  void init();
+
+  std::shared_ptr<const std::string> src_;
+  bool one_byte_;
+  std::vector<uint16_t> two_byte_;
+  uint64_t hash_;
+};
+#endif
+
+/// \struct _Stats
+///
+/// _Stats instances hold the timings in nanoseconds and the counters of eval and call (see _V8::set_stats_enabled()).
+/// For the native value versions of call, the JSON timings are the conversion times of the arguments and the result.
+struct _Stats {
+  _Stats();
+
+  uint64_t calls;              ///< number of evals and calls
+  uint64_t errors;             ///< number of evals and calls which failed
+  uint64_t bytes_in;           ///< total size of the JavaScript code and the JSON-encoded arguments
+  uint64_t bytes_out;          ///< total size of the JSON-encoded results
+  uint64_t lock_wait_ns;       ///< time spent waiting for other threads using the instance
+  uint64_t compile_ns;         ///< time spent compiling (or looking up compiled scripts)
+  uint64_t run_ns;             ///< time spent running JavaScript, including waiting for promises
+  uint64_t json_parse_ns;      ///< time spent decoding arguments
+  uint64_t json_stringify_ns;  ///< time spent encoding results
+  uint64_t gc_ns;              ///< time spent in garbage collection, which is also included in the other timings
+};
+
+/// \struct _HostResult
+///
+/// _HostResult instances receive the outcome of a host function call (see _HostFunction::call()).
+struct _HostResult {
+  std::string value;  ///< JSON-encoded result ("undefined" for undefined), or an error message
+};
+
+/// \class _HostFunction
+///
+/// _HostFunction instances are native functions which JavaScript can call as globals (see _V8::register_function()).
+/// Subclasses implement call(), including ones written in the languages of the bindings.
+class _HostFunction {
+ public:
+  virtual ~_HostFunction();
+
+  /// \brief Handle a call from JavaScript
+  /// \param args JSON-encoded array of the arguments
+  /// \param result JSON-encoded result on success, or an error message on failure
+  /// \return success or not as boolean
+  ///
+  /// On failure, the error message is thrown to the calling JavaScript code as the message of an Error.
+  /// This method is called in the thread running the script, and must not use the _V8 instance calling it.
+  virtual bool call(const std::string& args, _HostResult* result) = 0;
+};
+
+/// \struct _SourceChunk
+///
+/// _SourceChunk instances receive a chunk read by a source reader (see _SourceReader::read()).
+struct _SourceChunk {
+  std::string data;  ///< next chunk encoded in UTF-8 (empty at the end of the code), or an error message
+};
+
+/// \class _SourceReader
+///
+/// _SourceReader instances read JavaScript code in chunks for _V8::eval_stream(), e.g. from a file or a socket.
+/// Subclasses implement read(), including ones written in the languages of the bindings.
+class _SourceReader {
+ public:
+  virtual ~_SourceReader();
+
+  /// \brief Read the next chunk of JavaScript code
+  /// \param chunk Next chunk on success, or an error message on failure
+  /// \return success or not as boolean
+  ///
+  /// This method is called in the thread calling eval_stream().
+  /// A chunk may end in the middle of a UTF-8 sequence.
+  /// On failure, eval_stream() stops reading and returns "Error: " followed by the error message.
+  virtual bool read(_SourceChunk* chunk) = 0;
+};
+
 /// \class _V8
 ///
 /// _V8 instances can be used in multiple threads.
 /// But each _V8 instance can be used in only one thread at a time.
 class _V8 {
  public:
-  _V8();
+  /// \brief Create a V8 instance
+  /// \param max_old_space_size Maximum size of the old generation heap in MB (0 for the V8 default)
+  /// \param max_semi_space_size Maximum size of a young generation semi-space in MB (0 for the V8 default)
+  ///
+  /// If a heap limit is given and a script keeps the heap close to it even after a full GC,
+  /// the script is terminated and "RangeError: Heap limit reached" is returned
+  /// instead of V8 aborting the whole process.
+  /// This is best effort: a single allocation larger than the remaining heap still aborts the process.
+  /// ArrayBuffers are allocated by the allocator set by set_array_buffer_allocator() at this point.
+  _V8(int max_old_space_size = 0, int max_semi_space_size = 0);
   virtual ~_V8();
 
   /// \brief Evaluate JavaScript code
@@ -37,6 +295,33 @@ class _V8 {
   /// If some JavaScript exception happens in runtime, the exception message is returned.
   std::string eval(const std::string& src);
 
+#ifndef SWIG
+  /// \brief Evaluate shared JavaScript code
+  /// \param src JavaScript code
+  /// \return JSON-encoded result or exception message
+  ///
+  /// This method is the same as eval() except that V8 reads 'src' in place without copying it.
+  /// It suits large libraries loaded by many instances.
+  std::string eval(const std::shared_ptr<const Source>& src);
+#endif
+
+  /// \brief Evaluate JavaScript code read in chunks
+  /// \param reader Reader of JavaScript code
+  /// \return JSON-encoded result or exception message
+  ///
+  /// This method is the same as eval() but parses the code in a background thread while it is being read,
+  /// so that parsing a large script overlaps with reading it.
+  /// The execution timeout applies only after the whole code has been read.
+  /// The code is not kept in the compiled script cache.
+  std::string eval_stream(_SourceReader* reader);
+
+  /// \brief Evaluate a JavaScript file
+  /// \param path Path of a JavaScript file
+  /// \return JSON-encoded result or exception message
+  ///
+  /// This method streams the file 'path' into eval_stream().
+  std::string eval_file(const std::string& path);
+
   /// \brief Call a JavaScript function
   /// \param func Name of a JavaScript function
   /// \param args JSON-encoded argument array
@@ -48,16 +333,508 @@ class _V8 {
   /// If some JavaScript exception happens in runtime, the exception message is returned.
   std::string call(const std::string& func, const std::string& args);
 
+#ifndef SWIG
+  /// \brief Call a JavaScript function with native values
+  /// \param func Name of a JavaScript function
+  /// \param args Argument array
+  /// \param result Result of the function
+  /// \param error Exception message (can be nullptr)
+  /// \return success or not as boolean
+  ///
+  /// This method calls the JavaScript function specified by 'func' with the arguments 'args'
+  /// converted directly to JavaScript values, and converts its result back into 'result'.
+  /// No JSON encoding or decoding is involved.
+  /// If some JavaScript exception happens in runtime, false is returned and the exception message is stored into 'error'.
+  bool call(const std::string& func, const Value::Array& args, Value* result, std::string* error = nullptr);
+#endif
+
+  /// \brief Call a JavaScript function with multiple argument arrays
+  /// \param func Name of a JavaScript function
+  /// \param args JSON-encoded array of argument arrays
+  /// \return JSON-encoded array of results or exception message
+  ///
+  /// This method calls the JavaScript function specified by 'func' once for each argument array in 'args'
+  /// and returns the array of the results in JSON.
+  /// The function is looked up and the arguments are decoded only once for the whole batch.
+  /// If some JavaScript exception happens in runtime, the batch stops and the exception message is returned.
+  std::string call_batch(const std::string& func, const std::string& args);
+
+#ifndef SWIG
+  /// \brief Call a JavaScript function with multiple native argument arrays
+  /// \param func Name of a JavaScript function
+  /// \param args Argument arrays
+  /// \param results Results of the function, one for each argument array
+  /// \param error Exception message (can be nullptr)
+  /// \return success or not as boolean
+  ///
+  /// This method is the native value version of call_batch().
+  bool call_batch(const std::string& func, const std::vector<Value::Array>& args, Value::Array* results,
+                  std::string* error = nullptr);
+#endif
+
+  /// \brief Warm up a JavaScript function
+  /// \param func Name of a JavaScript function
+  /// \param args JSON-encoded array of sample argument arrays
+  /// \param iterations Number of calls with each sample argument array
+  /// \return empty string or exception message
+  ///
+  /// This method calls the JavaScript function specified by 'func' 'iterations' times
+  /// with each argument array in 'args' and discards the results,
+  /// so that V8 compiles and optimizes the function for such inputs before the first actual call.
+  /// The samples should have the same types and shapes as the actual arguments.
+  /// If some JavaScript exception happens in runtime, the warmup stops and the exception message is returned.
+  std::string warmup(const std::string& func, const std::string& args, int iterations);
+
+  /// \brief Register a host function
+  /// \param name Name of the global function
+  /// \param function Host function
+  /// \return success or not as boolean
+  ///
+  /// This method defines a global JavaScript function 'name' which calls 'function',
+  /// so that scripts call back into the host directly.
+  /// It is defined in every context of this instance, including the ones created afterwards.
+  /// 'function' is owned by the caller and must outlive this instance.
+  bool register_function(const std::string& name, _HostFunction* function);
+
+  /// \brief Add a module to the module registry
+  /// \param name Name of the module
+  /// \param src JavaScript code of the module
+  ///
+  /// This method makes the module available to the global function "require(name)",
+  /// which is defined in every context of this instance once a module or a module directory is set.
+  /// Modules follow the CommonJS convention: the code of a module assigns what it exports to 'exports'
+  /// or 'module.exports', and requires other modules by their names.
+  /// A module is compiled once for this instance and run once for each context requiring it.
+  void add_module(const std::string& name, const std::string& src);
+
+  /// \brief Set the directory of modules
+  /// \param dir Directory to load modules from ("" disables loading modules from files)
+  ///
+  /// "require(name)" loads a module which is not in the module registry from the file 'dir'/'name',
+  /// or 'dir'/'name'.js if it does not exist. Names containing ".." are not loaded.
+  void set_module_dir(const std::string& dir);
+
+  /// \brief Set the execution timeout
+  /// \param timeout_ms Timeout in milliseconds (0 disables the timeout)
+  ///
+  /// This method bounds the execution time of each following eval and call.
+  /// A script that runs past the timeout is terminated by a watchdog thread,
+  /// and "TimeoutError: Script execution timed out" is returned.
+  /// This instance remains usable afterwards.
+  void set_timeout(int timeout_ms);
+
+  /// \brief Set whether to wait for promises
+  /// \param await_promises Whether to wait for promises
+  ///
+  /// When enabled, eval and call run the microtask queue after the script,
+  /// and if the result is a Promise, return its fulfillment value instead of the Promise itself.
+  /// A rejected Promise is returned as an exception message.
+  /// Since there is no event loop, a Promise still pending after the microtasks
+  /// results in "Error: Promise was not settled".
+  void set_await_promises(bool await_promises);
+
+  /// \brief Reset the JavaScript global state
+  ///
+  /// This method disposes the selected context and creates a fresh one with the same name on the same isolate,
+  /// so that the globals defined by previous eval and call are discarded
+  /// at the cost of a context creation instead of a new _V8 instance.
+  /// The new context starts from the snapshot this instance was created with, if any.
+  /// The compiled script cache and the settings of this instance are kept.
+  /// _Function instances resolved before the reset keep referring to the old context.
+  void reset();
+
+  /// \brief Create a named context
+  /// \param name Name of the new context
+  /// \return false if a context named 'name' already exists
+  ///
+  /// Every context has its own JavaScript globals,
+  /// while all contexts of this instance share its heap, its settings and its compiled script cache.
+  /// The default context, which is selected initially, is named "".
+  bool create_context(const std::string& name);
+
+  /// \brief Select the context used by eval and call
+  /// \param name Name of a context
+  /// \return false if there is no context named 'name'
+  bool select_context(const std::string& name);
+
+  /// \brief Dispose a named context
+  /// \param name Name of a context
+  /// \return false if there is no context named 'name' or 'name' is the default context
+  ///
+  /// If the disposed context is selected, the default context is selected instead.
+  bool dispose_context(const std::string& name);
+
+  /// \brief Get the name of the selected context
+  /// \return name of the selected context
+  std::string context_name() const;
+
+#ifndef SWIG
+  /// \brief Share a caller-owned buffer with JavaScript
+  /// \param name Name of the global variable
+  /// \param data Buffer
+  /// \param length Length of 'data' in bytes
+  /// \param error Exception message (can be nullptr)
+  /// \return success or not as boolean
+  ///
+  /// This method assigns an ArrayBuffer backed by 'data' to the global variable 'name' without copying it,
+  /// so that JavaScript reads and writes 'data' through typed arrays such as "new Uint8Array(name)".
+  /// The caller keeps owning 'data', and must call release_buffer() before freeing it.
+  bool set_buffer(const std::string& name, void* data, size_t length, std::string* error = nullptr);
+
+  /// \brief Get the memory of a JavaScript binary value
+  /// \param name Name of a global variable holding an ArrayBuffer or an ArrayBufferView (e.g. a Uint8Array)
+  /// \param data Memory of the value
+  /// \param length Length of the value in bytes
+  /// \param error Exception message (can be nullptr)
+  /// \return success or not as boolean
+  ///
+  /// This method returns the memory of a binary result without copying it.
+  /// The memory stays valid until release_buffer() is called for 'name',
+  /// even if the global variable is reassigned in the meantime.
+  /// A buffer previously passed to set_buffer() for 'name' is released if the variable no longer holds it.
+  bool get_buffer(const std::string& name, void** data, size_t* length, std::string* error = nullptr);
+
+  /// \brief Release a buffer
+  /// \param name Name given to set_buffer() or get_buffer()
+  /// \return false if there is no buffer for 'name' in the selected context
+  ///
+  /// A buffer passed to set_buffer() is detached from JavaScript, whose views of it become empty,
+  /// so the caller can free it afterwards.
+  /// The memory returned by get_buffer() must not be used afterwards.
+  /// Resetting or disposing a context releases its buffers.
+  bool release_buffer(const std::string& name);
+#endif
+
+  /// \brief Set the limit of ArrayBuffer memory
+  /// \param limit Maximum total size of the ArrayBuffers of this instance in bytes (0 disables the limit)
+  ///
+  /// An ArrayBuffer allocation past the limit fails with "RangeError: Array buffer allocation failed".
+  void set_array_buffer_limit(size_t limit);
+
+  /// \brief Get the ArrayBuffer memory in use
+  /// \return total size of the ArrayBuffers of this instance in bytes
+  ///
+  /// ArrayBuffers no longer referenced are counted until they are garbage-collected.
+  size_t array_buffer_bytes() const;
+
+  /// \brief Set whether to record stats
+  /// \param enabled Whether to record stats (disabled by default)
+  ///
+  /// When enabled, every eval and call records where its time went and what it transferred.
+  /// The records cost a few clock reads per eval or call.
+  void set_stats_enabled(bool enabled);
+
+  /// \brief Get the cumulative stats
+  /// \return sum of the stats of every eval and call since the stats were enabled or reset
+  _Stats stats() const;
+
+  /// \brief Get the stats of the last eval or call
+  /// \return stats of the last eval or call, whose 'calls' is 1
+  _Stats last_stats() const;
+
+  /// \brief Reset the stats
+  void reset_stats();
+
+  /// \brief Set the capacity of the compiled script cache
+  /// \param capacity Maximum number of compiled scripts (0 disables the cache)
+  ///
+  /// This method sets how many compiled scripts are kept by this instance.
+  /// Scripts are keyed by a hash of their source code and evicted in least-recently-used order,
+  /// so that evaluating the same code again skips parsing and compilation.
+  void set_script_cache_capacity(size_t capacity);
+
+  /// \brief Get the number of compiled script cache hits
+  /// \return number of evaluations that reused a compiled script
+  size_t script_cache_hits() const;
+
+  /// \brief Get the number of compiled script cache misses
+  /// \return number of evaluations that compiled their script from source
+  size_t script_cache_misses() const;
+
+  /// \brief Produce a code cache for JavaScript code
+  /// \param src JavaScript code
+  /// \return code cache data, or an empty string if 'src' cannot be compiled
+  ///
+  /// This method compiles the given JavaScript code 'src' without running it
+  /// and returns V8's serialized code for it.
+  /// The data can be passed to consume_code_cache() in a later process running the same V8 build.
+  std::string produce_code_cache(const std::string& src);
+
+  /// \brief Compile JavaScript code from a code cache
+  /// \param src JavaScript code
+  /// \param data Code cache data produced for 'src'
+  /// \return whether 'data' was accepted by V8
+  ///
+  /// This method compiles the given JavaScript code 'src' by using the code cache 'data'
+  /// and keeps the result in the compiled script cache, so that a following eval of 'src' does not parse it.
+  /// If 'data' is rejected (e.g. it was produced by another V8 version), 'src' is compiled from scratch.
+  bool consume_code_cache(const std::string& src, const std::string& data);
+
+  /// \brief Set the directory of the persistent code cache
+  /// \param dir Directory to store code caches in ("" disables the persistent code cache)
+  ///
+  /// When this directory is set, eval consumes the code cache stored there for its source code
+  /// if there is one, and stores a newly produced code cache otherwise.
+  /// A code cache rejected by V8 (e.g. after a V8 upgrade) is replaced.
+  /// The directory must exist and can be shared by multiple processes.
+  void set_code_cache_dir(const std::string& dir);
+
  private:
+  friend class _Function;
+  friend class StatsScope;
+  friend class V8Pool;
+  friend class V8Executor;
+
+  static void check_heap_limit(v8::Isolate* isolate, v8::GCType type, v8::GCCallbackFlags flags);
+  static void gc_prologue(v8::Isolate* isolate, v8::GCType type, v8::GCCallbackFlags flags);
+  static void gc_epilogue(v8::Isolate* isolate, v8::GCType type, v8::GCCallbackFlags flags);
+  static void call_host_function(const v8::FunctionCallbackInfo<v8::Value>& info);
+  static void require(const v8::FunctionCallbackInfo<v8::Value>& info);
+  void enable_modules();
+  void install_require(v8::Local<v8::Context> context);
+  bool load_module(const std::string& name, std::string* src);
+  v8::MaybeLocal<v8::UnboundScript> compile_module(const std::string& name);
+  v8::Local<v8::FunctionTemplate> new_host_function(_HostFunction* function);
   v8::Local<v8::Context> new_context();
+  v8::Local<v8::Context> current_context();
+  typedef std::map<std::pair<std::string, std::string>,
+                   v8::Persistent<v8::ArrayBuffer, v8::CopyablePersistentTraits<v8::ArrayBuffer>>>
+      BufferMap;  // keyed by context name and variable name
+  void release_buffer(BufferMap::iterator it);
+  void release_buffers(const std::string& context_name);
+  typedef std::map<std::string,
+                   v8::Persistent<v8::UnboundScript, v8::CopyablePersistentTraits<v8::UnboundScript>>>
+      ModuleMap;  // keyed by module name
+  v8::MaybeLocal<v8::Function> get_function(v8::Local<v8::Context> context, const std::string& func);
+  bool settle_promise(v8::Local<v8::Context> context, v8::Local<v8::Value>* value);
+  std::string call_function(v8::Local<v8::Context> context, v8::Local<v8::Function> function, const std::string& args,
+                            const v8::TryCatch& try_catch, const ExecutionScope& execution);
+  std::string eval(const std::string& src, const std::shared_ptr<const Source>& external, bool* failed = nullptr);
+  bool try_eval(const std::string& src, std::string* result);
+  std::string run_script(v8::Local<v8::Context> context, v8::Local<v8::Script> script, const v8::TryCatch& try_catch,
+                         const ExecutionScope& execution);
+  v8::MaybeLocal<v8::Script> compile(const std::string& src, const std::shared_ptr<const Source>& external);
+  v8::MaybeLocal<v8::UnboundScript> compile_unbound(const std::string& src, uint64_t hash,
+                                                    const std::shared_ptr<const Source>& external);
+  v8::MaybeLocal<v8::UnboundScript> compile_unbound(const std::string& src, v8::ScriptCompiler::CompileOptions options,
+                                                    std::string* cache,
+                                                    const std::shared_ptr<const Source>& external = nullptr);
+  bool produce_isolated_code_cache(const std::string& src, std::string* cache);
   v8::Local<v8::String> new_string(const char* str);
+  v8::MaybeLocal<v8::String> new_string(const std::string& str);
+  v8::MaybeLocal<v8::String> new_external_string(const std::shared_ptr<const Source>& source);
   v8::Local<v8::Value> json_parse(v8::Local<v8::Context> context, v8::Local<v8::String> str);
   v8::Local<v8::String> json_stringify(v8::Local<v8::Context> context, v8::Local<v8::Value> value);
+#ifndef SWIG
+  bool to_v8(v8::Local<v8::Context> context, const Value& value, v8::Local<v8::Value>* result);
+  bool from_v8(v8::Local<v8::Context> context, v8::Local<v8::Value> value, Value* result, int depth = 0);
+  bool call_function(v8::Local<v8::Context> context, v8::Local<v8::Function> function, const Value::Array& args,
+                     Value* result, std::string* error, const v8::TryCatch& try_catch, const ExecutionScope& execution);
+#endif
 
  private:
+  AccountingAllocator* allocator_;
   v8::Isolate* isolate_;
   v8::Persistent<v8::Context> context_;
+  std::string context_name_;
+  std::map<std::string, v8::Persistent<v8::Context, v8::CopyablePersistentTraits<v8::Context>>> contexts_;
+  BufferMap buffers_;
+  std::map<std::string, _HostFunction*> host_functions_;
+  std::shared_ptr<const std::string> snapshot_;
+  v8::StartupData startup_data_;
+  int timeout_ms_;
+  bool heap_limit_reached_;
+  size_t old_space_limit_;  // in bytes, 0 without a heap limit
+  bool await_promises_;
+  bool stats_enabled_;
+  uint64_t gc_start_ns_;
+  uint64_t gc_ns_;
+  _Stats stats_;
+  _Stats last_stats_;
+  mutable std::mutex stats_mutex_;
+  ScriptCache* script_cache_;
+  std::string code_cache_dir_;
+  bool modules_enabled_;
+  std::map<std::string, std::string> modules_;
+  std::string module_dir_;
+  ModuleMap compiled_modules_;
+};
+
+/// \class _Function
+///
+/// _Function instances are JavaScript functions resolved once from the global object of a _V8 instance,
+/// so that calling them skips the lookup by name.
+/// A _Function instance must be deleted before its _V8 instance and follows the same threading rules.
+class _Function {
+ public:
+  /// \brief Resolve a JavaScript function
+  /// \param v8 _V8 instance
+  /// \param func Name of a JavaScript function
+  ///
+  /// The function is resolved when this instance is created.
+  /// Assigning another value to 'func' in JavaScript afterwards does not affect this instance.
+  _Function(_V8* v8, const std::string& func);
+  virtual ~_Function();
+
+  /// \brief Check whether the function was resolved
+  /// \return whether 'func' was a function when this instance was created
+  bool is_function() const;
+
+  /// \brief Call the JavaScript function
+  /// \param args JSON-encoded argument array
+  /// \return JSON-encoded result or exception message
+  ///
+  /// This method is the same as _V8::call() without the lookup of the function.
+  std::string call(const std::string& args);
+
+#ifndef SWIG
+  /// \brief Call the JavaScript function with native values
+  /// \param args Argument array
+  /// \param result Result of the function
+  /// \param error Exception message (can be nullptr)
+  /// \return success or not as boolean
+  ///
+  /// This method is the same as _V8::call() with native values without the lookup of the function.
+  bool call(const Value::Array& args, Value* result, std::string* error = nullptr);
+#endif
+
+ private:
+  _V8* v8_;
+  std::string func_;
+  v8::Persistent<v8::Function> function_;
+};
+
+#ifndef SWIG
+/// \class V8Pool
+///
+/// V8Pool instances hold a fixed number of _V8 instances bootstrapped with the same JavaScript code
+/// and lend them out one request at a time.
+/// V8Pool instances can be used in multiple threads at the same time.
+class V8Pool {
+ public:
+  /// \brief Create a pool of _V8 instances
+  /// \param size Number of _V8 instances
+  /// \param src JavaScript code evaluated by every _V8 instance on creation
+  ///
+  /// The instances are created and bootstrapped in parallel.
+  /// Whether 'src' succeeded is reported by ok() and error().
+  V8Pool(size_t size, const std::string& src);
+  virtual ~V8Pool();
+
+  /// \brief Check out a _V8 instance
+  /// \return _V8 instance for the exclusive use of the caller
+  ///
+  /// This method blocks until an instance is available.
+  /// The instance must be returned by release() and must not be deleted.
+  /// A pool of no instances returns nullptr instead of blocking forever.
+  _V8* acquire();
+
+  /// \brief Return a _V8 instance
+  /// \param v8 _V8 instance checked out by acquire()
+  ///
+  /// This method returns the given instance to the pool as it is, including its global state.
+  void release(_V8* v8);
+
+  /// \brief Get the number of _V8 instances
+  /// \return number of _V8 instances in the pool
+  size_t size() const;
+
+  /// \brief Check whether the instances were bootstrapped
+  /// \return whether 'src' ran without an exception in every instance
+  bool ok() const;
+
+  /// \brief Get the bootstrap error
+  /// \return exception message of 'src', or an empty string if ok()
+  const std::string& error() const;
+
+ private:
+  std::string error_;
+  std::vector<_V8*> instances_;
+  std::vector<_V8*> available_;
+  std::mutex mutex_;
+  std::condition_variable released_;
+};
+
+/// \class V8Executor
+///
+/// V8Executor instances run evaluations and calls asynchronously on worker threads.
+/// Each worker thread owns a _V8 instance bootstrapped with the same JavaScript code,
+/// and each request runs on whichever worker is free first.
+/// V8Executor instances can be used in multiple threads at the same time,
+/// and must be deleted before the V8 runtime environment is disposed.
+class V8Executor {
+ public:
+  /// Callback receiving a JSON-encoded result or exception message on a worker thread.
+  /// It must not throw, since an exception would terminate the worker thread.
+  typedef std::function<void(const std::string&)> Callback;
+
+  /// \brief Create an executor
+  /// \param num_threads Number of worker threads (must be positive)
+  /// \param src JavaScript code evaluated by every worker on startup
+  /// \param await_promises Whether the workers wait for promises (see _V8::set_await_promises())
+  ///
+  /// With 'await_promises', async JavaScript functions can be called,
+  /// and the callbacks receive what their promises are settled with.
+  /// An executor without worker threads rejects every request with "Error: V8Executor has no worker threads".
+  V8Executor(size_t num_threads, const std::string& src, bool await_promises = false);
+
+  /// \brief Delete an executor
+  ///
+  /// The destructor waits until all the requests submitted so far have finished.
+  virtual ~V8Executor();
+
+  /// \brief Evaluate JavaScript code asynchronously
+  /// \param src JavaScript code
+  /// \return future of the JSON-encoded result or exception message
+  std::future<std::string> eval(const std::string& src);
+
+  /// \brief Evaluate JavaScript code asynchronously
+  /// \param src JavaScript code
+  /// \param callback Callback invoked with the JSON-encoded result or exception message
+  void eval(const std::string& src, const Callback& callback);
+
+  /// \brief Call a JavaScript function asynchronously
+  /// \param func Name of a JavaScript function
+  /// \param args JSON-encoded argument array
+  /// \return future of the JSON-encoded result or exception message
+  std::future<std::string> call(const std::string& func, const std::string& args);
+
+  /// \brief Call a JavaScript function asynchronously
+  /// \param func Name of a JavaScript function
+  /// \param args JSON-encoded argument array
+  /// \param callback Callback invoked with the JSON-encoded result or exception message
+  void call(const std::string& func, const std::string& args, const Callback& callback);
+
+  /// \brief Check whether the workers were bootstrapped
+  /// \return whether 'src' ran without an exception in every worker
+  ///
+  /// This method waits until every worker has evaluated 'src'.
+  bool ok() const;
+
+  /// \brief Get the bootstrap error
+  /// \return exception message of 'src', or an empty string if ok()
+  ///
+  /// This method waits until every worker has evaluated 'src'.
+  std::string error() const;
+
+ private:
+  typedef std::function<void(_V8*)> Task;
+
+  void submit(const Task& task);
+  void run();
+
+  std::string src_;
+  bool await_promises_;
+  bool stop_;
+  size_t num_bootstrapped_;
+  std::string error_;
+  std::deque<Task> tasks_;
+  mutable std::mutex mutex_;
+  std::condition_variable submitted_;
+  mutable std::condition_variable bootstrapped_;
+  std::vector<std::thread> threads_;
 };
+#endif
 
 }  // namespace v8eval
 
@@ -1,9 +1,14 @@
-%module v8eval
+%module(directors="1") v8eval
 %include "std_string.i"
+%include "stdint.i"
 
 %{
 #define SWIG_FILE_WITH_INIT
 #include "v8eval.h"
 %}
 
+// allow the bindings to implement host functions and source readers
+%feature("director") v8eval::_HostFunction;
+%feature("director") v8eval::_SourceReader;
+
 %include "v8eval.h"
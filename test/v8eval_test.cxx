@@ -1,6 +1,14 @@
 #include "v8eval.h"
 
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <memory>
 #include <thread>
+#include <vector>
 
 #include "gtest/gtest.h"
 
@@ -19,6 +27,43 @@ class V8Eval {
 
 V8Eval v8eval;
 
+std::string read_file(const std::string& path) {
+  std::string data;
+  FILE* fp = fopen(path.c_str(), "rb");
+  if (fp) {
+    char buf[8192];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), fp)) > 0) {
+      data.append(buf, n);
+    }
+    fclose(fp);
+  }
+  return data;
+}
+
+void write_file(const std::string& path, const std::string& data) {
+  FILE* fp = fopen(path.c_str(), "wb");
+  if (fp) {
+    fwrite(data.data(), 1, data.size(), fp);
+    fclose(fp);
+  }
+}
+
+// paths of the files in 'dir'
+std::vector<std::string> list_dir(const std::string& dir) {
+  std::vector<std::string> paths;
+  DIR* dp = opendir(dir.c_str());
+  if (dp) {
+    while (struct dirent* entry = readdir(dp)) {
+      if (strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0) {
+        paths.push_back(dir + "/" + entry->d_name);
+      }
+    }
+    closedir(dp);
+  }
+  return paths;
+}
+
 }  // namespace
 
 void test_eval() {
@@ -55,6 +100,574 @@ TEST(V8EvalTest, Call) {
   test_call();
 }
 
+TEST(V8EvalTest, EmbeddedNul) {
+  v8eval::_V8 v8;
+
+  ASSERT_EQ(std::string("\"a\\u0000b\""), v8.eval(std::string("'a\0b'", 5)));
+  ASSERT_EQ(std::string("a\0b", 3), v8.eval(std::string("throw 'a\0b'", 11)));
+}
+
+TEST(V8EvalTest, CallWithValues) {
+  v8eval::_V8 v8;
+
+  ASSERT_STREQ("undefined", v8.eval("function inc(x) { return x + 1; }").c_str());
+  ASSERT_STREQ("undefined", v8.eval("function echo(x) { return x; }").c_str());
+  ASSERT_STREQ("undefined", v8.eval("function fail() { return foo; }").c_str());
+
+  v8eval::Value result;
+  std::string error;
+  ASSERT_TRUE(v8.call("inc", { v8eval::Value(8) }, &result, &error));
+  ASSERT_EQ(v8eval::Value::kNumber, result.type());
+  ASSERT_EQ(9, result.number());
+
+  v8eval::Value::Object object;
+  object["a"] = v8eval::Value(true);
+  object["b"] = v8eval::Value::Array({ v8eval::Value(1.5), v8eval::Value(std::string("x\0y", 3)), v8eval::Value::null() });
+  ASSERT_TRUE(v8.call("echo", { v8eval::Value(object) }, &result, &error));
+  ASSERT_TRUE(result == v8eval::Value(object));
+
+  ASSERT_TRUE(v8.call("echo", {}, &result, &error));
+  ASSERT_EQ(v8eval::Value::kUndefined, result.type());
+
+  ASSERT_FALSE(v8.call("foo", {}, &result, &error));
+  ASSERT_EQ("TypeError: 'foo' is not a function", error);
+  ASSERT_FALSE(v8.call("fail", {}, &result, &error));
+  ASSERT_EQ("ReferenceError: foo is not defined", error);
+}
+
+TEST(V8EvalTest, Function) {
+  v8eval::_V8 v8;
+
+  ASSERT_STREQ("undefined", v8.eval("function inc(x) { return x + 1; }").c_str());
+  v8eval::_Function inc(&v8, "inc");
+  ASSERT_TRUE(inc.is_function());
+  ASSERT_STREQ("9", inc.call("[8]").c_str());
+  ASSERT_STREQ("TypeError: '[' is not an array", inc.call("[").c_str());
+
+  v8eval::Value result;
+  ASSERT_TRUE(inc.call({ v8eval::Value(9) }, &result));
+  ASSERT_TRUE(result == v8eval::Value(10));
+
+  ASSERT_STREQ("undefined", v8.eval("inc = null;").c_str());
+  ASSERT_STREQ("11", inc.call("[10]").c_str());
+
+  v8eval::_Function foo(&v8, "foo");
+  ASSERT_FALSE(foo.is_function());
+  ASSERT_STREQ("TypeError: 'foo' is not a function", foo.call("[]").c_str());
+}
+
+TEST(V8EvalTest, CallBatch) {
+  v8eval::_V8 v8;
+
+  ASSERT_STREQ("undefined", v8.eval("function add(x, y) { return x + y; }").c_str());
+  ASSERT_STREQ("[3,7]", v8.call_batch("add", "[[1,2],[3,4]]").c_str());
+  ASSERT_STREQ("[]", v8.call_batch("add", "[]").c_str());
+
+  ASSERT_STREQ("TypeError: '{}' is not an array", v8.call_batch("add", "{}").c_str());
+  ASSERT_STREQ("TypeError: '1' is not an array", v8.call_batch("add", "[1]").c_str());
+  ASSERT_STREQ("TypeError: 'foo' is not a function", v8.call_batch("foo", "[]").c_str());
+
+  std::vector<v8eval::Value::Array> args = { { v8eval::Value(1), v8eval::Value(2) }, { v8eval::Value("a"), v8eval::Value("b") } };
+  v8eval::Value::Array results;
+  ASSERT_TRUE(v8.call_batch("add", args, &results));
+  ASSERT_EQ(2u, results.size());
+  ASSERT_TRUE(results[0] == v8eval::Value(3));
+  ASSERT_TRUE(results[1] == v8eval::Value("ab"));
+}
+
+TEST(V8EvalTest, Warmup) {
+  v8eval::_V8 v8;
+
+  ASSERT_STREQ("undefined", v8.eval("var n = 0; function add(x, y) { n++; return x + y; }").c_str());
+  ASSERT_STREQ("", v8.warmup("add", "[[1,2],[3,4]]", 100).c_str());
+  ASSERT_STREQ("200", v8.eval("n").c_str());
+  ASSERT_STREQ("", v8.warmup("add", "[[1,2]]", 0).c_str());
+  ASSERT_STREQ("200", v8.eval("n").c_str());
+
+  ASSERT_STREQ("TypeError: '{}' is not an array", v8.warmup("add", "{}", 1).c_str());
+  ASSERT_STREQ("TypeError: '1' is not an array", v8.warmup("add", "[1]", 1).c_str());
+  ASSERT_STREQ("TypeError: 'foo' is not a function", v8.warmup("foo", "[]", 1).c_str());
+
+  ASSERT_STREQ("undefined", v8.eval("function fail() { throw new Error('fail'); }").c_str());
+  ASSERT_STREQ("Error: fail", v8.warmup("fail", "[[]]", 10).c_str());
+}
+
+TEST(V8EvalTest, Timeout) {
+  v8eval::_V8 v8;
+  v8.set_timeout(100);
+
+  ASSERT_STREQ("TimeoutError: Script execution timed out", v8.eval("while (true) {}").c_str());
+  ASSERT_STREQ("3", v8.eval("1 + 2").c_str());
+
+  ASSERT_STREQ("undefined", v8.eval("function loop() { for (;;) {} }").c_str());
+  ASSERT_STREQ("TimeoutError: Script execution timed out", v8.call("loop", "[]").c_str());
+  ASSERT_STREQ("undefined", v8.eval("function inc(x) { return x + 1; }").c_str());
+  ASSERT_STREQ("9", v8.call("inc", "[8]").c_str());
+
+  v8.set_timeout(0);
+  ASSERT_STREQ("3", v8.eval("1 + 2").c_str());
+}
+
+TEST(V8EvalTest, Promise) {
+  v8eval::_V8 v8;
+
+  ASSERT_STREQ("{}", v8.eval("Promise.resolve(1)").c_str());
+
+  v8.set_await_promises(true);
+  ASSERT_STREQ("1", v8.eval("Promise.resolve(1)").c_str());
+  ASSERT_STREQ("3", v8.eval("Promise.resolve(1).then(function (x) { return x + 2; })").c_str());
+  ASSERT_STREQ("Error: failed", v8.eval("Promise.reject(new Error('failed'))").c_str());
+  ASSERT_STREQ("Error: Promise was not settled", v8.eval("new Promise(function () {})").c_str());
+  ASSERT_STREQ("Error: Promise was not settled",
+               v8.eval("var r; new Promise(function (resolve) { r = resolve; })").c_str());
+  ASSERT_STREQ("undefined", v8.eval("r(1)").c_str());
+  ASSERT_STREQ("undefined", v8.eval("var n = 0; Promise.resolve().then(function () { n++; }); undefined").c_str());
+  ASSERT_STREQ("1", v8.eval("n").c_str());
+
+  ASSERT_STREQ("undefined", v8.eval("function inc(x) { return Promise.resolve(x + 1); }").c_str());
+  ASSERT_STREQ("9", v8.call("inc", "[8]").c_str());
+  ASSERT_STREQ("[2,3]", v8.call_batch("inc", "[[1],[2]]").c_str());
+
+  v8eval::V8Executor executor(1, "function inc(x) { return Promise.resolve(x + 1); }", true);
+  ASSERT_EQ("9", executor.call("inc", "[8]").get());
+}
+
+TEST(V8EvalTest, Reset) {
+  v8eval::_V8 v8;
+
+  ASSERT_STREQ("undefined", v8.eval("var x = 1; function f() { return x; }").c_str());
+  ASSERT_STREQ("1", v8.call("f", "[]").c_str());
+
+  v8.reset();
+  ASSERT_STREQ("\"undefined\"", v8.eval("typeof x").c_str());
+  ASSERT_STREQ("TypeError: 'f' is not a function", v8.call("f", "[]").c_str());
+  ASSERT_STREQ("{\"a\":2}", v8.eval("JSON.parse('{\"a\":2}')").c_str());
+
+  ASSERT_STREQ("undefined", v8.eval("var x = 2; function f() { return x; }").c_str());
+  ASSERT_STREQ("2", v8.call("f", "[]").c_str());
+}
+
+TEST(V8EvalTest, Contexts) {
+  v8eval::_V8 v8;
+
+  ASSERT_STREQ("undefined", v8.eval("var x = 'default'; function f() { return x; }").c_str());
+  ASSERT_TRUE(v8.create_context("a"));
+  ASSERT_FALSE(v8.create_context("a"));
+  ASSERT_TRUE(v8.create_context("b"));
+
+  ASSERT_TRUE(v8.select_context("a"));
+  ASSERT_EQ("a", v8.context_name());
+  ASSERT_STREQ("\"undefined\"", v8.eval("typeof x").c_str());
+  ASSERT_STREQ("undefined", v8.eval("var x = 'a'; function f() { return x; }").c_str());
+  ASSERT_STREQ("\"a\"", v8.call("f", "[]").c_str());
+  std::unique_ptr<v8eval::_Function> f(new v8eval::_Function(&v8, "f"));
+
+  ASSERT_TRUE(v8.select_context("b"));
+  ASSERT_STREQ("TypeError: 'f' is not a function", v8.call("f", "[]").c_str());
+  ASSERT_STREQ("\"a\"", f->call("[]").c_str());
+  v8.reset();
+
+  ASSERT_TRUE(v8.select_context(""));
+  ASSERT_STREQ("\"default\"", v8.call("f", "[]").c_str());
+  ASSERT_FALSE(v8.select_context("c"));
+  ASSERT_EQ("", v8.context_name());
+
+  ASSERT_TRUE(v8.select_context("a"));
+  ASSERT_FALSE(v8.dispose_context(""));
+  ASSERT_FALSE(v8.dispose_context("c"));
+  ASSERT_TRUE(v8.dispose_context("a"));
+  ASSERT_EQ("", v8.context_name());
+  ASSERT_STREQ("\"default\"", v8.call("f", "[]").c_str());
+  ASSERT_FALSE(v8.select_context("a"));
+}
+
+TEST(V8EvalTest, ArrayBufferLimit) {
+  v8eval::_V8 v8;
+
+  size_t bytes = v8.array_buffer_bytes();
+  ASSERT_STREQ("1024", v8.eval("var a = new ArrayBuffer(1024); a.byteLength").c_str());
+  ASSERT_EQ(bytes + 1024, v8.array_buffer_bytes());
+
+  v8.set_array_buffer_limit(bytes + 2048);
+  ASSERT_STREQ("RangeError: Array buffer allocation failed", v8.eval("new ArrayBuffer(2048)").c_str());
+  ASSERT_STREQ("512", v8.eval("new Uint8Array(512).length").c_str());
+
+  v8.set_array_buffer_limit(0);
+  ASSERT_STREQ("4096", v8.eval("new ArrayBuffer(4096).byteLength").c_str());
+}
+
+TEST(V8EvalTest, Buffer) {
+  v8eval::_V8 v8;
+
+  std::vector<uint8_t> input = {1, 2, 3, 4};
+  ASSERT_TRUE(v8.set_buffer("input", input.data(), input.size()));
+  ASSERT_STREQ("10", v8.eval("Array.prototype.reduce.call(new Uint8Array(input), function (x, y) { return x + y; })").c_str());
+  ASSERT_STREQ("5", v8.eval("new Uint8Array(input)[0] = 5").c_str());
+  ASSERT_EQ(5, input[0]);
+
+  void* data;
+  size_t length;
+  ASSERT_STREQ("undefined", v8.eval("var output = new Uint8Array(4).subarray(1); output[0] = 7;"
+                                    "var view = new Uint8Array(input); undefined").c_str());
+  ASSERT_TRUE(v8.get_buffer("output", &data, &length));
+  ASSERT_STREQ("undefined", v8.eval("output = undefined").c_str());
+  ASSERT_EQ(3u, length);
+  ASSERT_EQ(7, static_cast<uint8_t*>(data)[0]);
+  ASSERT_TRUE(v8.release_buffer("output"));
+
+  ASSERT_TRUE(v8.release_buffer("input"));
+  ASSERT_FALSE(v8.release_buffer("input"));
+  ASSERT_STREQ("[0,0]", v8.eval("[input.byteLength, view.length]").c_str());
+
+  // the caller's buffer is detached once 'name' holds another buffer
+  ASSERT_TRUE(v8.set_buffer("buf", input.data(), input.size()));
+  ASSERT_STREQ("undefined", v8.eval("var v = new Uint8Array(buf); buf = new ArrayBuffer(2); undefined").c_str());
+  ASSERT_TRUE(v8.get_buffer("buf", &data, &length));
+  ASSERT_EQ(2u, length);
+  ASSERT_STREQ("0", v8.eval("v.length").c_str());
+  ASSERT_TRUE(v8.release_buffer("buf"));
+
+  std::string error;
+  ASSERT_FALSE(v8.get_buffer("input2", &data, &length, &error));
+  ASSERT_EQ("TypeError: 'input2' is not an ArrayBuffer or an ArrayBufferView", error);
+}
+
+TEST(V8EvalTest, ArrayBufferPool) {
+  v8eval::ArrayBufferPool pool(1024);
+
+  void* data = pool.AllocateUninitialized(100);
+  memset(data, 1, 100);
+  pool.Free(data, 100);
+  ASSERT_EQ(128u, pool.cached_bytes());
+
+  char* reused = static_cast<char*>(pool.Allocate(120));
+  ASSERT_EQ(data, reused);
+  ASSERT_EQ(0u, pool.cached_bytes());
+  for (int i = 0; i < 120; i++) {
+    ASSERT_EQ(0, reused[i]);
+  }
+  pool.Free(reused, 120);
+
+  void* uncached = pool.Allocate(2048);
+  pool.Free(uncached, 2048);
+  ASSERT_EQ(128u, pool.cached_bytes());
+
+  v8eval::set_array_buffer_allocator(&pool);
+  {
+    v8eval::_V8 v8;
+    ASSERT_STREQ("true", v8.eval("Array.prototype.every.call(new Uint8Array(64), function (x) { return x === 0; })").c_str());
+  }
+  v8eval::set_array_buffer_allocator(nullptr);
+}
+
+TEST(V8EvalTest, Stats) {
+  v8eval::_V8 v8;
+
+  ASSERT_STREQ("undefined", v8.eval("function add(x, y) { return x + y; }").c_str());
+  ASSERT_EQ(0u, v8.stats().calls);
+
+  v8.set_stats_enabled(true);
+  ASSERT_STREQ("3", v8.eval("1 + 2").c_str());
+  v8eval::_Stats last = v8.last_stats();
+  ASSERT_EQ(1u, last.calls);
+  ASSERT_EQ(0u, last.errors);
+  ASSERT_EQ(5u, last.bytes_in);
+  ASSERT_EQ(1u, last.bytes_out);
+  ASSERT_GT(last.compile_ns, 0u);
+  ASSERT_GT(last.run_ns, 0u);
+
+  ASSERT_STREQ("3", v8.call("add", "[1,2]").c_str());
+  last = v8.last_stats();
+  ASSERT_EQ(5u, last.bytes_in);
+  ASSERT_EQ(0u, last.compile_ns);
+  ASSERT_GT(last.json_parse_ns, 0u);
+  ASSERT_GT(last.json_stringify_ns, 0u);
+
+  ASSERT_STREQ("ReferenceError: foo is not defined", v8.eval("foo").c_str());
+  ASSERT_EQ(3u, v8.last_stats().bytes_in);
+  ASSERT_STREQ("TypeError: '{}' is not an array", v8.call("add", "{}").c_str());
+  ASSERT_EQ(2u, v8.last_stats().bytes_in);
+  v8eval::_Function missing(&v8, "missing");
+  ASSERT_STREQ("TypeError: 'missing' is not a function", missing.call("[]").c_str());
+  ASSERT_EQ(1u, v8.last_stats().errors);
+  v8eval::Value result;
+  ASSERT_TRUE(v8.call("add", v8eval::Value::Array{v8eval::Value(1), v8eval::Value(2)}, &result));
+
+  v8eval::_Stats stats = v8.stats();
+  ASSERT_EQ(6u, stats.calls);
+  ASSERT_EQ(3u, stats.errors);
+  ASSERT_GE(stats.run_ns, last.run_ns);
+
+  v8.reset_stats();
+  ASSERT_EQ(0u, v8.stats().calls);
+  ASSERT_EQ(0u, v8.last_stats().calls);
+}
+
+class Lookup : public v8eval::_HostFunction {
+ public:
+  bool call(const std::string& args, v8eval::_HostResult* result) {
+    if (args == "[\"a\"]") {
+      result->value = "{\"value\":1}";
+      return true;
+    } else if (args == "[]") {
+      result->value = "undefined";
+      return true;
+    } else if (args == "[\"invalid\"]") {
+      result->value = "{";
+      return true;
+    }
+    result->value = args == "[404]" ? "404" : "not found: " + args;
+    return false;
+  }
+};
+
+TEST(V8EvalTest, HostFunction) {
+  Lookup lookup;
+  v8eval::_V8 v8;
+
+  ASSERT_TRUE(v8.register_function("lookup", &lookup));
+  ASSERT_STREQ("{\"value\":1}", v8.eval("lookup('a')").c_str());
+  ASSERT_STREQ("undefined", v8.eval("lookup()").c_str());
+  ASSERT_STREQ("Error: not found: [\"b\",null]", v8.eval("lookup('b', undefined)").c_str());
+  ASSERT_STREQ("\"not found: [1]\"", v8.eval("try { lookup(1); } catch (e) { e.message }").c_str());
+  ASSERT_STREQ("Error: 404", v8.eval("lookup(404)").c_str());
+  ASSERT_STREQ("SyntaxError: Unexpected end of input", v8.eval("lookup('invalid')").c_str());
+
+  ASSERT_STREQ("undefined", v8.eval("function get(key) { return lookup(key).value; }").c_str());
+  ASSERT_STREQ("1", v8.call("get", "[\"a\"]").c_str());
+
+  v8.reset();
+  ASSERT_STREQ("1", v8.eval("lookup('a').value").c_str());
+  ASSERT_TRUE(v8.create_context("other"));
+  ASSERT_TRUE(v8.select_context("other"));
+  ASSERT_STREQ("\"function\"", v8.eval("typeof lookup").c_str());
+}
+
+TEST(V8EvalTest, Modules) {
+  v8eval::_V8 v8;
+
+  ASSERT_STREQ("\"undefined\"", v8.eval("typeof require").c_str());
+  v8.add_module("add", "module.exports = function (x, y) { return x + y; };");
+  v8.add_module("math", "var add = require('add'); exports.sum = function (xs) { return xs.reduce(add, 0); };");
+  ASSERT_STREQ("6", v8.eval("require('math').sum([1, 2, 3])").c_str());
+  ASSERT_STREQ("true", v8.eval("require('math') === require('math')").c_str());
+  ASSERT_STREQ("Error: Cannot find module 'none'", v8.eval("require('none')").c_str());
+
+  v8.add_module("counter", "var n = 0; exports.next = function () { return ++n; };");
+  ASSERT_STREQ("2", v8.eval("require('counter').next(); require('counter').next()").c_str());
+  v8.reset();
+  ASSERT_STREQ("1", v8.eval("require('counter').next()").c_str());
+
+  v8.add_module("a", "exports.b = function () { return require('b').name; }; exports.name = 'a';");
+  v8.add_module("b", "exports.a = require('a').name; exports.name = 'b';");
+  ASSERT_STREQ("[\"b\",\"a\"]", v8.eval("[require('a').b(), require('b').a]").c_str());
+
+  v8.add_module("broken", "throw new Error('broken');");
+  ASSERT_STREQ("Error: broken", v8.eval("require('broken')").c_str());
+
+  // modules do not depend on the script cache, and a replaced module is compiled again
+  v8.set_script_cache_capacity(0);
+  v8.add_module("counter", "exports.next = function () { return 0; };");
+  v8.reset();
+  ASSERT_STREQ("0", v8.eval("require('counter').next()").c_str());
+  ASSERT_STREQ("6", v8.eval("require('math').sum([1, 2, 3])").c_str());
+}
+
+class ChunkReader : public v8eval::_SourceReader {
+ public:
+  ChunkReader(const std::string& src, size_t chunk_size) : src_(src), chunk_size_(chunk_size), pos_(0) {}
+
+  bool read(v8eval::_SourceChunk* chunk) {
+    chunk->data = src_.substr(pos_, chunk_size_);
+    pos_ += chunk->data.size();
+    return true;
+  }
+
+ private:
+  std::string src_;
+  size_t chunk_size_;
+  size_t pos_;
+};
+
+// fails after the first chunk
+class FailingReader : public v8eval::_SourceReader {
+ public:
+  FailingReader() : first_(true) {}
+
+  bool read(v8eval::_SourceChunk* chunk) {
+    if (first_) {
+      first_ = false;
+      chunk->data = "var x = 1;";
+      return true;
+    }
+    chunk->data = "connection reset";
+    return false;
+  }
+
+ private:
+  bool first_;
+};
+
+TEST(V8EvalTest, EvalStream) {
+  v8eval::_V8 v8;
+
+  ChunkReader reader("function f(s) { return s + '\xe3\x81\x82'; } f('x')", 3);
+  ASSERT_STREQ("\"x\xe3\x81\x82\"", v8.eval_stream(&reader).c_str());
+  ASSERT_STREQ("\"y\xe3\x81\x82\"", v8.call("f", "[\"y\"]").c_str());
+  ASSERT_STREQ("\"function f(s) { return s + '\xe3\x81\x82'; }\"", v8.eval("f.toString()").c_str());
+
+  ChunkReader empty("", 1);
+  ASSERT_STREQ("undefined", v8.eval_stream(&empty).c_str());
+  ChunkReader invalid("var x = ;", 4);
+  ASSERT_STREQ("SyntaxError: Unexpected token ;", v8.eval_stream(&invalid).c_str());
+  FailingReader failing;
+  ASSERT_STREQ("Error: connection reset", v8.eval_stream(&failing).c_str());
+  ASSERT_STREQ("\"undefined\"", v8.eval("typeof x").c_str());
+
+  char path[] = "/tmp/v8eval_test_XXXXXX";
+  int fd = mkstemp(path);
+  ASSERT_NE(-1, fd);
+  std::string src = "var sum = 0; for (var i = 0; i < 100; i++) { sum += i; } sum";
+  ASSERT_EQ(static_cast<ssize_t>(src.size()), write(fd, src.data(), src.size()));
+  close(fd);
+  ASSERT_STREQ("4950", v8.eval_file(path).c_str());
+  unlink(path);
+  ASSERT_EQ("Error: Cannot open file '" + std::string(path) + "'", v8.eval_file(path));
+}
+
+TEST(V8EvalTest, HeapLimit) {
+  v8eval::_V8 v8(32);
+
+  ASSERT_STREQ("undefined", v8.eval("var a = [];").c_str());
+  ASSERT_STREQ("RangeError: Heap limit reached", v8.eval("for (;;) { a.push({}); }").c_str());
+  ASSERT_STREQ("undefined", v8.eval("a = null;").c_str());
+  ASSERT_STREQ("3", v8.eval("1 + 2").c_str());
+}
+
+TEST(V8EvalTest, ScriptCache) {
+  v8eval::_V8 v8;
+
+  ASSERT_STREQ("undefined", v8.eval("var n = 0;").c_str());
+  ASSERT_STREQ("1", v8.eval("++n").c_str());
+  ASSERT_STREQ("2", v8.eval("++n").c_str());
+  ASSERT_EQ(1u, v8.script_cache_hits());
+  ASSERT_EQ(2u, v8.script_cache_misses());
+
+  v8.set_script_cache_capacity(1);
+  ASSERT_STREQ("3", v8.eval("n + 1").c_str());
+  ASSERT_STREQ("3", v8.eval("++n").c_str());
+  ASSERT_EQ(1u, v8.script_cache_hits());
+  ASSERT_EQ(4u, v8.script_cache_misses());
+
+  v8.set_script_cache_capacity(0);
+  ASSERT_STREQ("4", v8.eval("++n").c_str());
+  ASSERT_EQ(1u, v8.script_cache_hits());
+  ASSERT_EQ(4u, v8.script_cache_misses());
+}
+
+TEST(V8EvalTest, Source) {
+  std::shared_ptr<const v8eval::Source> ascii = std::make_shared<v8eval::Source>("function inc(x) { return x + 1; }");
+  std::shared_ptr<const v8eval::Source> utf8 = std::make_shared<v8eval::Source>("var s = '\xc3\xa9\xf0\x9f\x98\x80'; s.length");
+
+  for (int i = 0; i < 2; i++) {
+    v8eval::_V8 v8;
+    ASSERT_STREQ("undefined", v8.eval(ascii).c_str());
+    ASSERT_STREQ("9", v8.call("inc", "[8]").c_str());
+    ASSERT_STREQ("3", v8.eval(utf8).c_str());
+    ASSERT_STREQ("\"\xc3\xa9\xf0\x9f\x98\x80\"", v8.eval("s").c_str());
+    ASSERT_STREQ("3", v8.eval(utf8).c_str());
+    ASSERT_EQ(1u, v8.script_cache_hits());
+  }
+}
+
+TEST(V8EvalTest, CodeCache) {
+  const std::string src = "function inc(x) { return x + 1; }";
+
+  std::string cache;
+  {
+    v8eval::_V8 v8;
+    cache = v8.produce_code_cache(src);
+    ASSERT_FALSE(cache.empty());
+    ASSERT_TRUE(v8.produce_code_cache("@").empty());
+  }
+
+  {
+    v8eval::_V8 v8;
+    ASSERT_FALSE(v8.consume_code_cache(src, "broken"));
+
+    // the script is in the isolate's compilation cache now
+    ASSERT_FALSE(v8.produce_code_cache(src).empty());
+  }
+
+  v8eval::_V8 v8;
+  ASSERT_TRUE(v8.consume_code_cache(src, cache));
+  ASSERT_STREQ("undefined", v8.eval(src).c_str());
+  ASSERT_EQ(1u, v8.script_cache_hits());
+  ASSERT_STREQ("9", v8.call("inc", "[8]").c_str());
+}
+
+TEST(V8EvalTest, CodeCacheDir) {
+  const std::string src = "function inc(x) { return x + 1; }";
+
+  char dir[] = "/tmp/v8eval_test_XXXXXX";
+  ASSERT_TRUE(mkdtemp(dir) != nullptr);
+
+  {
+    v8eval::_V8 v8;
+    v8.set_code_cache_dir(dir);
+    ASSERT_STREQ("undefined", v8.eval(src).c_str());
+  }
+
+  std::vector<std::string> paths = list_dir(dir);
+  ASSERT_EQ(1u, paths.size());
+  ASSERT_FALSE(read_file(paths[0]).empty());
+
+  // a rejected code cache is replaced
+  write_file(paths[0], "broken");
+  {
+    v8eval::_V8 v8;
+    v8.set_code_cache_dir(dir);
+    ASSERT_STREQ("undefined", v8.eval(src).c_str());
+    ASSERT_STREQ("9", v8.call("inc", "[8]").c_str());
+  }
+
+  ASSERT_EQ(paths, list_dir(dir));
+  std::string cache = read_file(paths[0]);
+  ASSERT_NE("broken", cache);
+  {
+    v8eval::_V8 v8;
+    ASSERT_TRUE(v8.consume_code_cache(src, cache));
+  }
+
+  unlink(paths[0].c_str());
+  rmdir(dir);
+}
+
+TEST(V8EvalTest, Snapshot) {
+  std::string snapshot = v8eval::create_snapshot("function inc(x) { return x + 1; }");
+  ASSERT_FALSE(snapshot.empty());
+  ASSERT_TRUE(v8eval::create_snapshot("foo").empty());
+
+  v8eval::set_snapshot(snapshot);
+  {
+    v8eval::_V8 v8;
+    ASSERT_STREQ("9", v8.call("inc", "[8]").c_str());
+  }
+
+  v8eval::set_snapshot("");
+  {
+    v8eval::_V8 v8;
+    ASSERT_STREQ("TypeError: 'inc' is not a function", v8.call("inc", "[8]").c_str());
+  }
+}
+
+TEST(V8EvalTest, OverriddenJSON) {
+  v8eval::_V8 v8;
+
+  ASSERT_STREQ("undefined", v8.eval("function id(x) { return x; } JSON = undefined;").c_str());
+  ASSERT_STREQ("{\"a\":[1,2]}", v8.call("id", "[{\"a\":[1,2]}]").c_str());
+}
+
 void test_eval_repeatedly() {
   for (int i = 0; i < 20; i++) {
     test_eval();
@@ -78,3 +691,57 @@ TEST(V8EvalTest, Multithreading) {
   call.join();
   std::cout << std::endl;
 }
+
+TEST(V8EvalTest, Executor) {
+  v8eval::V8Executor executor(2, "function inc(x) { return x + 1; }");
+
+  std::vector<std::future<std::string>> results;
+  for (int i = 0; i < 10; i++) {
+    results.push_back(executor.call("inc", "[" + std::to_string(i) + "]"));
+  }
+  for (int i = 0; i < 10; i++) {
+    ASSERT_EQ(std::to_string(i + 1), results[i].get());
+  }
+
+  ASSERT_EQ("3", executor.eval("1 + 2").get());
+
+  std::promise<std::string> promise;
+  executor.call("foo", "[]", [&promise](const std::string& result) { promise.set_value(result); });
+  ASSERT_EQ("TypeError: 'foo' is not a function", promise.get_future().get());
+
+  ASSERT_TRUE(executor.ok());
+  v8eval::V8Executor broken(2, "foo");
+  ASSERT_FALSE(broken.ok());
+  ASSERT_EQ("ReferenceError: foo is not defined", broken.error());
+
+  v8eval::V8Executor empty(0, "");
+  ASSERT_TRUE(empty.ok());
+  ASSERT_EQ("Error: V8Executor has no worker threads", empty.eval("1 + 2").get());
+}
+
+TEST(V8EvalTest, Pool) {
+  v8eval::V8Pool pool(2, "function inc(x) { return x + 1; }");
+  ASSERT_EQ(2u, pool.size());
+  ASSERT_TRUE(pool.ok());
+
+  std::vector<std::thread> threads;
+  for (int i = 0; i < 4; i++) {
+    threads.push_back(std::thread([&pool]() {
+      for (int j = 0; j < 100; j++) {
+        v8eval::_V8* v8 = pool.acquire();
+        EXPECT_STREQ("9", v8->call("inc", "[8]").c_str());
+        pool.release(v8);
+      }
+    }));
+  }
+  for (size_t i = 0; i < threads.size(); i++) {
+    threads[i].join();
+  }
+
+  v8eval::V8Pool broken(2, "foo");
+  ASSERT_FALSE(broken.ok());
+  ASSERT_EQ("ReferenceError: foo is not defined", broken.error());
+
+  v8eval::V8Pool empty(0, "");
+  ASSERT_TRUE(empty.acquire() == nullptr);
+}